@@ -0,0 +1,63 @@
+#pragma once
+
+#include "camera.h"
+#include "render_cache.h"
+#include "scene.h"
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BATCH_PATH_LENGTH 256
+// Jobs up to this many pixels render whole on one worker, larger ones are
+// split into tiles across the pool
+#define BATCH_SMALL_PIXELS (512 * 512)
+
+typedef struct {
+    char path[BATCH_PATH_LENGTH];
+    scene world; // Shared by every job that names the same file
+    bool loaded;
+} batch_scene;
+
+typedef struct {
+    char output_path[BATCH_PATH_LENGTH];
+    size_t scene_index;
+    size_t width, height;
+    size_t samples;
+    camera cam;
+    scene *world;
+    render_cache *cache;
+    double latency_ms; // From the job starting to its image being written
+    bool failed;
+} batch_job;
+
+// Many independent renders read from a manifest, one job per line:
+//   <scene file> <output bmp> <width> <height> <samples> <x> <y> <z> <fov>
+// Blank lines and lines starting with # are skipped.
+typedef struct {
+    batch_scene *scenes;
+    size_t num_scenes;
+    size_t max_scenes;
+    batch_job *jobs;
+    size_t num_jobs;
+    size_t max_jobs;
+    render_cache *cache; // Jobs rendered before are read back, NULL for none
+} batch;
+
+typedef struct {
+    size_t jobs;
+    size_t scenes;
+    size_t failed;
+    double elapsed_ms;
+    double jobs_per_second;
+    double p50_ms; // Job latency percentiles, failed jobs included
+    double p99_ms;
+} batch_report;
+
+void batch_init(batch *b);
+void batch_destroy(batch *b);
+
+int batch_load_manifest(batch *b, const char *filepath);
+
+// Loads each distinct scene once, then renders every job and writes its
+// image. Returns -1 if any job failed, the rest are still written.
+int batch_run(batch *b, threadpool *pool, batch_report *report);
@@ -1,5 +1,5 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void write_bitmap(char *filename, unsigned int imgwidth, unsigned int imgheight,
-                  uint8_t *pixels, bool y_inverted);
+int write_bitmap(char *filename, unsigned int imgwidth, unsigned int imgheight,
+                 uint8_t *pixels, bool y_inverted);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Deepest level the builder splits to, which bounds traversal stacks
+#define BVH_MAX_DEPTH 64
+
+typedef struct {
+    vec3s min;
+    uint32_t left_first; // Left child for interior nodes, else first index
+    vec3s max;
+    uint32_t count; // Number of primitives in a leaf, 0 for interior nodes
+} bvh_node;
+
+typedef struct {
+    bvh_node *nodes;
+    size_t num_nodes;
+    uint32_t *indices; // Primitive indices, grouped by leaf
+    size_t num_indices;
+} bvh;
+
+void bvh_init(bvh *b);
+void bvh_build(bvh *b, const vec3s *prim_min, const vec3s *prim_max,
+               size_t num_prims);
+void bvh_destroy(bvh *b);
+
+bool bvh_intersect_node(const bvh_node *node, const vec3s origin,
+                        const vec3s inv_direction, float max_distance,
+                        float *entry_distance);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+
+// Pinhole camera looking down +z
+typedef struct {
+    vec3s position;
+    float fov; // Horizontal field of view in radians
+} camera;
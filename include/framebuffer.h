@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAMEBUFFER_MAX_SAMPLE 64.0f // Per-sample radiance cap, also drops NaN
+
+typedef struct {
+    size_t width, height;
+    vec3s *color;      // Sum of all radiance samples per pixel
+    uint32_t *samples; // Number of samples accumulated per pixel
+    vec3s *preview;    // Coarse estimate used until a pixel has samples
+} framebuffer;
+
+// Pixels [x0, x1) x [y0, y1)
+typedef struct {
+    size_t x0, y0, x1, y1;
+} framebuffer_region;
+
+void framebuffer_init(framebuffer *fb, size_t width, size_t height);
+void framebuffer_clear(framebuffer *fb);
+void framebuffer_destroy(framebuffer *fb);
+
+void framebuffer_add_sample(framebuffer *fb, size_t x, size_t y,
+                            const vec3s sample);
+vec3s framebuffer_get(const framebuffer *fb, size_t x, size_t y);
+uint32_t framebuffer_min_samples(const framebuffer *fb);
+uint32_t framebuffer_region_min_samples(const framebuffer *fb,
+                                        const framebuffer_region *region);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "camera.h"
+#include "ray.h"
+#include "scene.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { GBUFFER_EMPTY, GBUFFER_MISS, GBUFFER_HIT } gbuffer_state;
+
+// First hit of a pixel's camera ray. Camera rays are not jittered, so every
+// sample of a pixel shares it.
+typedef struct {
+    float distance;
+    vec3s normal;
+    uint32_t primitive;
+    material_index material;
+    uint8_t state;
+} gbuffer_texel;
+
+typedef struct {
+    size_t width, height;
+    gbuffer_texel *texels;
+
+    // Everything the cached hits depend on
+    uint64_t geometry_hash;
+    camera cam;
+} gbuffer;
+
+void gbuffer_init(gbuffer *g);
+void gbuffer_destroy(gbuffer *g);
+
+bool gbuffer_prepare(gbuffer *g, const scene *world, const camera *cam,
+                     size_t width, size_t height);
+void gbuffer_store(gbuffer_texel *texel, const ray_hit *hit);
+ray_hit gbuffer_hit(const gbuffer_texel *texel, const camera *cam,
+                    const vec3s direction);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "scene.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Scene serialized as vec4 records (identical under std140 and std430).
+// The shader reads the buffer through an RGBA32F view for floats and an
+// RGBA32I view for ivec4 and int fields, which would be denormals as
+// floats and may be flushed to zero. Offsets are in texels.
+//
+// header    0: ivec4(num_materials, num_spheres, num_triangles, 0)
+//           1: ivec4(material_offset, sphere_offset, triangle_offset, 0)
+// material  0: vec4(albedo, roughness)
+//           1: vec4(emission_color, emission_strength)
+//           2: vec4(metallicity, transparency, refractive_index, 0)
+// sphere    0: vec4(center, radius)
+//           1: ivec4(material, 0, 0, 0)
+// triangle  0: vec4(v0, int material)
+//           1: vec4(v1, 0)
+//           2: vec4(v2, 0)
+#define SCENE_BUFFER_TEXEL_SIZE 16
+#define SCENE_BUFFER_HEADER_TEXELS 2
+#define SCENE_BUFFER_MATERIAL_TEXELS 3
+#define SCENE_BUFFER_SPHERE_TEXELS 2
+#define SCENE_BUFFER_TRIANGLE_TEXELS 3
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+
+    // Byte range changed since the last upload, empty when begin == end
+    size_t dirty_begin;
+    size_t dirty_end;
+    bool resized; // Buffer size changed, storage must be reallocated
+} scene_buffer;
+
+void scene_buffer_init(scene_buffer *buf);
+void scene_buffer_destroy(scene_buffer *buf);
+
+void scene_buffer_pack(scene_buffer *buf, const scene *world);
+bool scene_buffer_dirty(const scene_buffer *buf);
+void scene_buffer_mark_clean(scene_buffer *buf);
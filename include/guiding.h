@@ -0,0 +1,51 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include "scene.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GUIDING_RESOLUTION 8  // Cells along each axis of the scene bounds
+#define GUIDING_THETA_BINS 8  // Bins over cos(theta), equal solid angle
+#define GUIDING_PHI_BINS 16
+#define GUIDING_BINS (GUIDING_THETA_BINS * GUIDING_PHI_BINS)
+#define GUIDING_TRAINING_PASSES 4 // Passes before the first fit
+
+// Voxel grid over the scene with a histogram of incident radiance over the
+// sphere of directions per cell. Learned from diffuse bounces and used to
+// importance-sample them, refitted each time the pass count doubles.
+typedef struct {
+    vec3s min;
+    vec3s cell_scale; // Cells per unit along each axis
+
+    _Atomic float *energy; // Training sums, per cell and direction bin
+    atomic_uint *records;  // Lit paths recorded per cell
+    float *cdf;            // Normalized running sums, valid once ready
+    bool *trained;         // Cells with enough lit paths to guide
+
+    uint64_t geometry_hash;
+    size_t passes;
+    size_t next_fit; // Pass count at which cdf is rebuilt
+    bool ready;      // Fitted at least once, sampling from the guide
+} guiding;
+
+void guiding_init(guiding *g);
+void guiding_destroy(guiding *g);
+
+// Keeps what was learned for the same geometry, otherwise starts over
+void guiding_prepare(guiding *g, const scene *world);
+
+// radiance is what arrived along direction, scaled by the factor returned
+// by guiding_sample for guided bounces
+void guiding_record(guiding *g, const vec3s point, const vec3s direction,
+                    const vec3s radiance);
+// Called between passes, refits the distributions when it is time
+void guiding_end_pass(guiding *g);
+
+// Picks a bounce direction off a diffuse surface from a mix of the learned
+// distribution and the cosine lobe. Returns cos / (pi * pdf), the factor
+// that replaces 1 for cosine sampling, or 0 below the surface.
+float guiding_sample(const guiding *g, const vec3s point, const vec3s normal,
+                     float u0, float u1, float u2, vec3s *direction);
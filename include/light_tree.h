@@ -0,0 +1,41 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Emissive primitive as seen by the light tree
+typedef struct {
+    uint32_t primitive;
+    vec3s min, max;
+    vec3s axis;     // Emission normal, unused when omnidirectional
+    bool two_sided; // Emits along both axis and -axis
+    bool omni;      // Emits in every direction, e.g. spheres
+    float power;
+} light_info;
+
+typedef struct {
+    vec3s min, max;
+    vec3s axis;        // Cone bounding the emission normals below
+    float cos_theta_o; // Cosine of the cone's half angle, -1 for no bound
+    float power;
+    uint32_t right_or_light; // Right child, or index into lights for leaves
+    bool leaf;               // Interior nodes have their left child next
+    bool two_sided; // Every emitter below is two-sided
+} light_node;
+
+typedef struct {
+    light_node *nodes;
+    size_t num_nodes;
+    uint32_t *lights; // Primitive id of every emitter
+    size_t num_lights;
+} light_tree;
+
+void light_tree_init(light_tree *t);
+void light_tree_build(light_tree *t, light_info *lights, size_t num_lights);
+void light_tree_destroy(light_tree *t);
+
+bool light_tree_sample(const light_tree *t, const vec3s point,
+                       const vec3s normal, float u, uint32_t *primitive,
+                       float *pmf);
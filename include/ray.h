@@ -3,13 +3,25 @@
 #include "cglm/types-struct.h"
 #include "scene.h"
 #include <stddef.h>
+#include <stdint.h>
+
+#define PACKET_MAX_LANES 16
 
 typedef struct {
     float distance;
     vec3s point;
     vec3s normal;
-    size_t material;
+    uint32_t primitive;
+    material_index material;
 } ray_hit;
 
+typedef struct {
+    vec3s origins[PACKET_MAX_LANES];
+    vec3s directions[PACKET_MAX_LANES];
+    size_t num_lanes;
+} ray_packet;
+
 ray_hit trace_ray(const vec3s origin, const vec3s direction,
                   const scene *world);
+void trace_packet(const ray_packet *packet, const scene *world,
+                  ray_hit *hits);
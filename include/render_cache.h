@@ -0,0 +1,35 @@
+#pragma once
+
+#include "framebuffer.h"
+#include <stdint.h>
+
+#define RENDER_CACHE_MAGIC "PTCACHE"
+#define RENDER_CACHE_VERSION 4
+#define RENDER_CACHE_PATH_LENGTH 256
+
+// On-disk store of accumulated framebuffers, one file per key. Keys hash
+// everything an image depends on except the sample count, so an entry can
+// be returned as is or rendered further.
+typedef struct {
+    char directory[RENDER_CACHE_PATH_LENGTH];
+} render_cache;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t padding;
+    uint64_t key;
+    uint64_t width, height;
+    // Followed by vec3s color[width * height], uint32_t samples[...]
+} render_cache_header;
+
+// Creates the directory if it does not exist
+int render_cache_init(render_cache *cache, const char *directory);
+
+// Fills the color sums and sample counts of fb, which must have the size
+// the entry was stored with. Returns -1 on a miss, leaving fb untouched.
+int render_cache_load(const render_cache *cache, uint64_t key,
+                      framebuffer *fb);
+// Replaces the entry atomically, concurrent readers see the old or new one
+int render_cache_store(const render_cache *cache, uint64_t key,
+                       const framebuffer *fb);
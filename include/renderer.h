@@ -1,13 +1,80 @@
 #pragma once
 
+#include "camera.h"
+#include "framebuffer.h"
+#include "gbuffer.h"
+#include "guiding.h"
+#include "ray.h"
+#include "render_cache.h"
 #include "scene.h"
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#define MAX_BOUNCES 4
+#define DIFFUSE_ROUGHNESS 1.0f // Scatters with a cosine lobe, samples lights
+
+// Secondary ray spawned at a surface, weighted by its share of the light
+typedef struct {
+    vec3s origin;
+    vec3s direction;
+    float weight;
+    bool reflected;
+} scattered_ray;
+
+// Restarts this thread's random stream, the same arguments give the same
+// sequence on any thread
+void rand_seed(uint64_t seed, uint64_t stream, uint64_t sample);
+// Stream position, for paths whose bounces are traced interleaved
+uint64_t rand_save();
+void rand_restore(uint64_t state);
+vec3s rand_unit_sphere();
+uint32_t rand_next();
+float rand_float();
+vec3s sample_direct_light(const ray_hit *hit, const scene *world);
+size_t scatter_rays(const vec3s direction, const ray_hit *hit,
+                    const hot_material *mat, scattered_ray *out);
+vec3s shade_hit(const vec3s direction, const ray_hit *hit, const scene *world,
+                guiding *guide, size_t bounces, bool count_emission);
+vec3s incident_light(vec3s origin, vec3s direction, const scene *world,
+                     guiding *guide, size_t bounces, bool count_emission);
+camera camera_default();
+vec3s primary_direction(const camera *cam, const float x, const float y,
+                        const float aspect_ratio);
+
+uint64_t monotonic_ns();
+
+typedef struct {
+    double budget_ms;     // Wall-clock budget for the whole render, 0 = none
+    size_t preview_scale; // Block size of the coarsest preview, 0 = none
+    size_t max_samples;   // Stop once pixels have this many, 0 = no limit
+    bool wavefront;       // Trace tiles breadth-first in sorted ray batches
+    bool packets;         // Trace camera rays in 4x4 packets
+    gbuffer *gbuffer;     // Reuse camera ray hits across renders if set
+    guiding *guiding;     // Learn and importance-sample diffuse bounces
+    uint64_t seed;        // Same settings and seed give the same image
+    render_cache *cache;  // Resume from and save accumulations if set,
+                          // not used together with guiding or a region
+
+    // Pixels to render, an x1 or y1 of 0 extends to the edge of the frame
+    framebuffer_region region;
+} progressive_settings;
+
 typedef struct {
-    int screen_y;
-    size_t framew, frameh;
-    uint8_t *frame;
-    scene *world;
-} render_args;
+    uint32_t samples_per_pixel; // Samples every pixel received
+    size_t passes;              // Passes started, including the cut-off one
+    double elapsed_ms;
+    bool deadline_hit;
+    uint32_t cached_samples; // Samples per pixel read from the cache
+} progressive_result;
 
-void render_task(render_args *arg);
+// Adds samples to the region of fb and leaves the rest alone, so one
+// framebuffer can be refined over several calls, max_samples counting the
+// samples already there. The preview starts at
+// 1 / preview_scale resolution and halves its block size down to 2 before
+// the full resolution passes. Renders on the calling thread alone when pool
+// is NULL.
+progressive_result render_progressive(threadpool *pool, scene *world,
+                                      const camera *cam, framebuffer *fb,
+                                      const progressive_settings *settings);
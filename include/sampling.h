@@ -0,0 +1,37 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include <stddef.h>
+
+// Sampling math on batches of uniform random numbers in [0, 1), with SSE2
+// versions of the transcendental functions and a scalar fallback using the
+// same polynomials. Directions are written as separate x, y and z arrays.
+//
+// Bounds over the inputs the samplers use, measured by sampling_bench:
+//   sampling_sincos_turns  absolute error below 1e-6
+//   sampling_log           absolute error below 1e-6 on (0, 1]
+//   sampling_rsqrt         relative error below 1e-6
+
+// sin and cos of 2 pi turns
+void sampling_sincos_turns(float turns, float *sin_out, float *cos_out);
+float sampling_log(float x);
+float sampling_rsqrt(float x);
+
+// Single samples, for paths traced one at a time
+vec3s sampling_unit_sphere_one(float u1, float u2);
+vec3s sampling_cosine_hemisphere_one(float u1, float u2);
+
+// Uniform over the unit sphere
+void sampling_unit_sphere(const float *u1, const float *u2, size_t count,
+                          float *x, float *y, float *z);
+// Cosine-weighted around +z
+void sampling_cosine_hemisphere(const float *u1, const float *u2,
+                                size_t count, float *x, float *y, float *z);
+// GGX half vectors around +z, distributed as D(h) cos(theta_h)
+void sampling_ggx(float alpha, const float *u1, const float *u2, size_t count,
+                  float *x, float *y, float *z);
+// Pairs of standard normal values by Box-Muller
+void sampling_normal(const float *u1, const float *u2, size_t count,
+                     float *out1, float *out2);
+// Scales each (x, y, z) to unit length in place
+void sampling_normalize(float *x, float *y, float *z, size_t count);
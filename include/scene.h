@@ -1,30 +1,97 @@
 #pragma once
 
+#include "bvh.h"
 #include "cglm/types-struct.h"
+#include "light_tree.h"
 #include "shapes.h"
+#include "wide_bvh.h"
 
-// TODO: convert objects and materials to vectors
+struct scene_mapping;
+
+// Primitives live in one aligned array per type. BVH primitive ids number
+// spheres first, then triangles. Fields are read-only to the renderer,
+// edits go through the add and set functions so that the acceleration
+// structures and hashes never go stale.
 typedef struct {
-    shape *objects;
-    size_t num_objects;
-    size_t max_objects;
+    sphere *spheres;
+    material_index *sphere_materials;
+    size_t num_spheres;
+    size_t max_spheres;
+
+    triangle *triangles;
+    material_index *triangle_materials;
+    size_t num_triangles;
+    size_t max_triangles;
+
+    hot_material *hot_materials;
     shape_material *materials;
     size_t num_materials;
     size_t max_materials;
+
     vec3s sky_color;
+    bvh accel; // Built on demand, discarded when objects are added
+    light_tree lights; // Emitters for light sampling, likewise on demand
+
+    // Cached by scene_update_geometry_hash, dropped by primitive edits
+    bool hashed;
+    uint64_t geometry_hash;
+
+    // Set for scenes mapped from a packed file, see scene_file.h. Their
+    // primitives point into the mapping and compact_accel replaces accel.
+    struct scene_mapping *mapping;
+    wide_bvh compact_accel;
 } scene;
 
 void scene_init(scene *s);
 
+// Returns the index of the new material, SIZE_MAX if it cannot be added
 size_t scene_add_material(scene *s, const vec3s albedo, const float roughness,
                           const float metallicity, const vec3s emission_color,
                           const float emission_strength,
                           const float transparency,
                           const float refractive_index);
+// Replaces a material in place, keeping both copies and the hashes in step
+int scene_set_material(scene *s, size_t index,
+                       const shape_material *material);
+
+// Fail on mapped scenes and materials the scene does not have
+int scene_add_sphere(scene *s, const vec3s center, const float radius,
+                     const size_t material);
+int scene_add_triangle(scene *s, const vec3s v0, const vec3s v1,
+                       const vec3s v2, const size_t material);
+
+// In-place edits, geometry edits drop the BVH and light tree like adds do
+void scene_set_sky(scene *s, const vec3s sky_color);
+int scene_set_sphere(scene *s, size_t index, const vec3s center,
+                     const float radius, const size_t material);
+int scene_set_triangle(scene *s, size_t index, const vec3s v0,
+                       const vec3s v1, const vec3s v2, const size_t material);
+
+size_t scene_num_primitives(const scene *s);
+material_index scene_primitive_material(const scene *s, size_t prim);
+void scene_primitive_bounds(const scene *s, size_t prim, vec3s *min,
+                            vec3s *max);
+
+// FNV-1a, continuing from hash
+uint64_t scene_hash_bytes(uint64_t hash, const void *data, size_t size);
+// Both hashes walk every primitive unless the geometry hash is cached.
+// Loading caches it, scenes built or edited in code can call this when done.
+void scene_update_geometry_hash(scene *s);
+uint64_t scene_geometry_hash(const scene *s);
+// Geometry, materials and sky, everything a rendered image depends on
+uint64_t scene_content_hash(const scene *s);
+
+void scene_build_accel(scene *s);
+void scene_build_lights(scene *s);
+void scene_bounds(const scene *s, vec3s *min, vec3s *max);
 
-void scene_add_sphere(scene *s, const vec3s center, const float radius,
-                      const size_t material);
-void scene_add_triangle(scene *s, const vec3s v0, const vec3s v1,
-                        const vec3s v2, const size_t material);
+// Text format, one entry per line, '#' starts a comment:
+//   sky r g b
+//   material albedo(3) roughness metallicity emission_color(3)
+//            emission_strength transparency refractive_index
+//   sphere center(3) radius material
+//   triangle v0(3) v1(3) v2(3) material
+// Materials are numbered in order of appearance, starting at 0.
+int scene_load(scene *s, const char *filepath);
 
 void scene_destroy(scene *s);
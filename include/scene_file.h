@@ -0,0 +1,82 @@
+#pragma once
+
+#include "scene.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCENE_FILE_MAGIC "PTSCENE"
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_ALIGNMENT 4096
+
+// Packed scene file, memory-mapped so the OS pages geometry in on demand.
+// Sections start on page boundaries in the order of the offsets below, so
+// the header, materials and top of the tree share the first pages.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_materials;
+    uint64_t num_spheres;
+    uint64_t num_triangles;
+    uint64_t num_nodes;
+    uint64_t num_indices;
+    uint64_t geometry_hash; // scene_geometry_hash of the source scene
+    vec3s sky_color;
+    uint32_t padding;
+
+    uint64_t materials_offset; // shape_material[num_materials]
+    uint64_t nodes_offset;     // wide_bvh_node[num_nodes]
+    uint64_t indices_offset;   // uint32_t[num_indices]
+    uint64_t spheres_offset;   // sphere[num_spheres]
+    uint64_t sphere_materials_offset;   // material_index[num_spheres]
+    uint64_t triangles_offset;          // triangle[num_triangles]
+    uint64_t triangle_materials_offset; // material_index[num_triangles]
+    uint64_t file_size;
+} scene_file_header;
+
+// Paging counters for the whole process since the scene was mapped
+typedef struct {
+    size_t mapped_bytes;
+    size_t resident_bytes;
+    size_t budget_bytes;
+    long minor_faults;
+    long major_faults; // Faults that had to read from disk
+    long blocks_read;  // 512 byte blocks read by the process
+    size_t trims;      // Times the resident set was cut back to the budget
+} scene_file_stats;
+
+// State of a mapped scene, owned by scene::mapping
+typedef struct scene_mapping {
+    uint8_t *data;
+    size_t size;
+    size_t pinned_bytes; // Prefix never dropped, header through top nodes
+    size_t budget_bytes; // 0 for no limit
+    uint64_t geometry_hash;
+    long base_minor_faults;
+    long base_major_faults;
+    long base_blocks_read;
+    size_t resident_bound; // Resident bytes at most, see scene_file_trim
+    long fault_count;      // Process faults when resident_bound was set
+    size_t trims;
+} scene_mapping;
+
+// Writes the scene with a quantized wide BVH, building the binary BVH
+// first if needed
+int scene_file_write(scene *s, const char *filepath);
+
+bool scene_file_detect(const char *filepath);
+
+// Maps a packed scene. The scene is read-only and, beyond its materials,
+// nothing is copied into memory. resident_budget is in bytes, 0 for none.
+int scene_file_map(scene *s, const char *filepath, size_t resident_budget);
+
+// Drops pages beyond the pinned prefix once the resident set exceeds the
+// budget, just enough to get back under it. The resident set is only
+// measured once the process has faulted in enough pages to possibly cross
+// the budget, so this is cheap enough to call between render passes.
+void scene_file_trim(scene *s);
+
+scene_file_stats scene_file_get_stats(const scene *s);
+
+// Called by scene_destroy
+void scene_file_unmap(scene *s);
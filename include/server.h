@@ -0,0 +1,59 @@
+#pragma once
+
+#include "gbuffer.h"
+#include "guiding.h"
+#include "render_cache.h"
+#include "scene.h"
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SERVER_SCENE_ID_LENGTH 64
+#define SERVER_MAX_IMAGE_SIZE 4096 // Default for render_server::max_image_size
+
+typedef struct {
+    char id[SERVER_SCENE_ID_LENGTH];
+    scene world; // Kept with its BVH built
+    gbuffer gbuf; // Camera ray hits of the last render
+    guiding guide; // Learned across renders of the same geometry
+} server_scene;
+
+// Long-running render server on a Unix socket. Clients send one request per
+// line and connections are served one at a time:
+//   LOAD <id> <scene file>  -> OK <primitives>
+//                              text scenes, or packed ones from --pack
+//   UNLOAD <id>             -> OK
+//   RENDER <id> <width> <height> <budget ms> <max samples> <x> <y> <z> <fov>
+//          [guiding] [seed] guiding is 1 to learn and sample bounce directions
+//          [<x0> <y0> <x1> <y1>]
+//                           crop, only pixels in [x0, x1) x [y0, y1) are
+//                           rendered and sent
+//                           -> OK <width> <height> <spp> <elapsed ms>
+//                              followed by width * height * 3 bytes of RGB,
+//                              the size being that of the crop if given.
+//                              Sizes are clamped to max_image_size. Each
+//                              connection keeps its image, repeating a
+//                              request refines it up to max samples.
+//   STATS <id>              -> OK <mapped bytes> <resident bytes> <budget>
+//                              <minor faults> <major faults> <blocks read>
+//                              <trims>, all 0 for scenes held in memory
+//   QUIT                    -> closes the connection
+//   SHUTDOWN                -> stops the server
+// Failures are reported as a single "ERR <reason>" line.
+typedef struct {
+    threadpool pool;
+    server_scene *scenes;
+    size_t num_scenes;
+    size_t max_scenes;
+    size_t resident_budget; // Bytes per packed scene, 0 for no limit
+    size_t max_image_size;  // Largest width or height a RENDER gets
+    render_cache *cache;    // Finished and partial renders, NULL for none
+    int listen_fd;
+    char socket_path[108];
+    bool running;
+} render_server;
+
+int render_server_init(render_server *srv, const char *socket_path,
+                       size_t num_threads);
+void render_server_run(render_server *srv);
+void render_server_destroy(render_server *srv);
@@ -2,6 +2,9 @@
 
 #include "cglm/types-struct.h"
 #include <stddef.h>
+#include <stdint.h>
+
+#define PRIMITIVE_ALIGNMENT 64
 
 typedef struct {
     vec3s center;
@@ -14,6 +17,7 @@ typedef struct {
     vec3s v2;
 } triangle;
 
+// Parameters as authored, only read outside of intersection and shading
 typedef struct {
     vec3s albedo;
     float roughness;
@@ -26,11 +30,13 @@ typedef struct {
     float refractive_index;
 } shape_material;
 
+// Subset of a material read on every hit, half a cache line
 typedef struct {
-    enum { SPHERE, TRIANGLE } tag;
-    size_t material;
-    union {
-        sphere sphere;
-        triangle triangle;
-    };
-} shape;
+    vec3s albedo;
+    float roughness;
+    vec3s emission; // emission_color * emission_strength
+    float transparency;
+} hot_material;
+
+typedef uint16_t material_index;
+#define MAX_MATERIALS (UINT16_MAX + 1) // Every index fits in material_index
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "vector.h"
 #include <pthread.h>
 #include <stdbool.h>
@@ -9,6 +11,8 @@ typedef struct {
     pthread_mutex_t tasks_mutex;
     pthread_cond_t tasks_available_cond;
     pthread_cond_t tasks_exhausted_cond;
+    pthread_cond_t group_finished_cond;
+    size_t tasks_running;
     bool threads_running;
 } threadpool;
 
@@ -18,3 +22,22 @@ void threadpool_destroy(threadpool *pool);
 void threadpool_add_task(threadpool *pool, void (*f)(void *), void *arg);
 
 void threadpool_wait_for_tasks(threadpool *pool);
+
+// Set of tasks that can be waited on independently of the rest of the pool
+typedef struct {
+    threadpool *pool;
+    size_t pending; // Tasks added and not yet finished, guarded by the pool
+} task_group;
+
+void task_group_init(task_group *group, threadpool *pool);
+void task_group_add(task_group *group, void (*f)(void *), void *arg);
+
+// Runs queued tasks on the calling thread until the group is finished, so
+// it can be called from inside a task without deadlocking the pool
+void task_group_wait(task_group *group);
+
+// Calls f on chunks of [begin, end) across the pool and returns when all
+// are done. A grain of 0 picks a chunk size from the number of threads.
+// Without a pool, f is called once on the whole range on this thread.
+void parallel_for(threadpool *pool, size_t begin, size_t end, size_t grain,
+                  void (*f)(void *ctx, size_t begin, size_t end), void *ctx);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "cglm/types-struct.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TONEMAP_NOISE_SIZE 32 // Side of the tiled blue noise texture
+
+typedef enum {
+    TONEMAP_CLAMP,    // Linear, anything above 1 clips
+    TONEMAP_REINHARD, // x / (1 + x)
+    TONEMAP_ACES,     // Narkowicz's fit of the ACES filmic curve
+} tonemap_operator;
+
+typedef struct {
+    float exposure; // In stops, 0 leaves radiance as rendered
+    tonemap_operator op;
+    bool dither; // Blue noise before quantizing, otherwise round to nearest
+} tonemap_settings;
+
+tonemap_settings tonemap_default();
+
+// Encodes one linear color to 8 bit sRGB, x and y pick the dither value
+void tonemap_pixel(const tonemap_settings *settings, const vec3s color,
+                   size_t x, size_t y, uint8_t *rgb);
+
+// Post-process of the accumulated framebuffer into 8 bit sRGB pixels,
+// split by rows across the pool, or on the calling thread if pool is NULL.
+// Leaves the framebuffer untouched so it can be re-run with new settings.
+void tonemap(threadpool *pool, const framebuffer *fb,
+             const tonemap_settings *settings, uint8_t *pixels);
+// Same for the pixels of region alone, written as rows of its own width.
+// They come out as they would from tonemap on the whole frame.
+void tonemap_region(threadpool *pool, const framebuffer *fb,
+                    const framebuffer_region *region,
+                    const tonemap_settings *settings, uint8_t *pixels);
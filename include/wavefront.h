@@ -0,0 +1,15 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "guiding.h"
+#include "renderer.h"
+#include "scene.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Each path draws from its own stream, seeded from its pixel and sample
+// count as in the other paths, so results do not depend on the tiling.
+// Diffuse bounces are guided and recorded as in shade_hit if guide is set.
+void wavefront_render_tile(const scene *world, const camera *cam,
+                           framebuffer *fb, guiding *guide, uint64_t seed,
+                           size_t x0, size_t y0, size_t x1, size_t y1);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "bvh.h"
+#include "cglm/types-struct.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIDE_BVH_WIDTH 4
+
+// Four children per node with their boxes quantized to 8 bits per plane,
+// relative to the node origin and rounded outwards. One cache line per node.
+typedef struct {
+    vec3s origin;
+    int8_t exponent[3]; // Quantization step along each axis is 2^exponent
+    uint8_t num_children;
+    uint8_t lo[3][WIDE_BVH_WIDTH];
+    uint8_t hi[3][WIDE_BVH_WIDTH];
+    uint32_t child[WIDE_BVH_WIDTH]; // Node index, or first primitive index
+    uint16_t count[WIDE_BVH_WIDTH]; // Primitives in a leaf child, 0 for nodes
+} wide_bvh_node;
+
+// Nodes are in breadth-first order so the top levels share the first pages
+typedef struct {
+    wide_bvh_node *nodes;
+    size_t num_nodes;
+    uint32_t *indices; // Primitive indices, grouped by leaf
+    size_t num_indices;
+} wide_bvh;
+
+void wide_bvh_init(wide_bvh *w);
+// Collapses a binary BVH, returns -1 if a leaf is too large to encode
+int wide_bvh_build(wide_bvh *w, const bvh *b);
+void wide_bvh_destroy(wide_bvh *w);
+
+void wide_bvh_bounds(const wide_bvh *w, vec3s *min, vec3s *max);
+
+// Sets bit i of the result for every child box the ray enters before
+// max_distance, with the entry distance in entry_distances[i]
+uint32_t wide_bvh_intersect_node(const wide_bvh_node *node,
+                                 const vec3s origin, const vec3s inv_direction,
+                                 float max_distance, float *entry_distances);
@@ -51,16 +51,70 @@ uniform vec2 window_size;
 uniform float aspect_ratio;
 uniform float fov;
 uniform vec3 sky_color;
-uniform Material materials[32];
 
-uniform Sphere spheres[32];
-uniform int sphere_count;
+// Packed scene, see include/gpu/scene_buffer.h for the layout. Both
+// samplers read the same buffer, integer fields go through scene_ints.
+uniform samplerBuffer scene_data;
+uniform isamplerBuffer scene_ints;
 
-uniform Triangle triangles[32];
-uniform int triangle_count;
+int sphere_count;
+int triangle_count;
+int material_offset;
+int sphere_offset;
+int triangle_offset;
 
 float tan_fov_2;
 
+void load_scene_header() {
+    ivec4 counts = texelFetch(scene_ints, 0);
+    ivec4 offsets = texelFetch(scene_ints, 1);
+    sphere_count = counts.y;
+    triangle_count = counts.z;
+    material_offset = offsets.x;
+    sphere_offset = offsets.y;
+    triangle_offset = offsets.z;
+}
+
+Material get_material(int i) {
+    int base = material_offset + 3 * i;
+    vec4 t0 = texelFetch(scene_data, base);
+    vec4 t1 = texelFetch(scene_data, base + 1);
+    vec4 t2 = texelFetch(scene_data, base + 2);
+
+    Material mat;
+    mat.albedo = t0.xyz;
+    mat.roughness = t0.w;
+    mat.emission_color = t1.xyz;
+    mat.emission_strength = t1.w;
+    mat.metallicity = t2.x;
+    mat.transparency = t2.y;
+    mat.refractive_index = t2.z;
+    return mat;
+}
+
+Sphere get_sphere(int i) {
+    int base = sphere_offset + 2 * i;
+    vec4 t0 = texelFetch(scene_data, base);
+
+    Sphere s;
+    s.center = t0.xyz;
+    s.radius = t0.w;
+    s.material = texelFetch(scene_ints, base + 1).x;
+    return s;
+}
+
+Triangle get_triangle(int i) {
+    int base = triangle_offset + 3 * i;
+    vec4 t0 = texelFetch(scene_data, base);
+
+    Triangle tr;
+    tr.v0 = t0.xyz;
+    tr.v1 = texelFetch(scene_data, base + 1).xyz;
+    tr.v2 = texelFetch(scene_data, base + 2).xyz;
+    tr.material = texelFetch(scene_ints, base).w;
+    return tr;
+}
+
 // PCG (permuted congruential generator). Thanks to:
 // www.pcg-random.org and www.shadertoy.com/view/XlGcRh
 uint next_random(inout uint state) {
@@ -75,18 +129,12 @@ float random_value(inout uint state) {
 }
 
 // Random value in normal distribution (with mean=0 and sd=1)
-float random_value_normal_dist(inout uint state) {
-    // Thanks to https://stackoverflow.com/a/6178290
-    float theta = 2 * M_PI * random_value(state);
-    float rho = sqrt(-2 * log(random_value(state)));
-    return rho * cos(theta);
-}
-
+// Uniform height and azimuth, two random values instead of six
 vec3 rand_unit_sphere(inout uint state) {
-    float x = random_value_normal_dist(state);
-    float y = random_value_normal_dist(state);
-    float z = random_value_normal_dist(state);
-    return normalize(vec3(x, y, z));
+    float z = 1 - 2 * random_value(state);
+    float phi = 2 * M_PI * random_value(state);
+    float r = sqrt(max(0, 1 - z * z));
+    return vec3(r * cos(phi), r * sin(phi), z);
 }
 
 float ray_sphere_intersect(vec3 o, vec3 d, Sphere s) {
@@ -161,20 +209,22 @@ RayHit trace_ray(vec3 origin, vec3 direction) {
 
     // Check spheres
     for (int i = 0; i < sphere_count; i++) {
-        float dist = ray_sphere_intersect(origin, direction, spheres[i]);
+        Sphere sphere = get_sphere(i);
+        float dist = ray_sphere_intersect(origin, direction, sphere);
 
         if (closest_hit.distance > 0 && (dist < 0 || dist >= closest_hit.distance))
             continue;
 
         closest_hit.distance = dist;
         closest_hit.point = origin + dist * direction;
-        closest_hit.normal = normalize(closest_hit.point - spheres[i].center);
-        closest_hit.material = spheres[i].material;
+        closest_hit.normal = normalize(closest_hit.point - sphere.center);
+        closest_hit.material = sphere.material;
     }
 
     // Check triangles
     for (int i = 0; i < triangle_count; i++) {
-        float dist = ray_triangle_intersect(origin, direction, triangles[i]);
+        Triangle triangle = get_triangle(i);
+        float dist = ray_triangle_intersect(origin, direction, triangle);
 
         if (closest_hit.distance > 0 && (dist < 0 || dist >= closest_hit.distance))
             continue;
@@ -182,10 +232,10 @@ RayHit trace_ray(vec3 origin, vec3 direction) {
         closest_hit.distance = dist;
         closest_hit.point = origin + dist * direction;
 
-        vec3 normal = normalize(cross(triangles[i].v0 - triangles[i].v1, triangles[i].v0 - triangles[i].v2));
+        vec3 normal = normalize(cross(triangle.v0 - triangle.v1, triangle.v0 - triangle.v2));
         closest_hit.normal = (2.0 * int(dot(direction, normal) < 0) - 1.0) * normal;
 
-        closest_hit.material = triangles[i].material;
+        closest_hit.material = triangle.material;
     }
 
     return closest_hit;
@@ -220,7 +270,7 @@ vec3 incident_light(vec3 origin, vec3 direction, inout uint rng_state) {
             total_light += current.color * sky_color;
             continue;
         }
-        Material mat = materials[hit.material];
+        Material mat = get_material(hit.material);
 
         // Surface emission
         vec3 Le = mat.emission_color * mat.emission_strength;
@@ -296,5 +346,6 @@ vec3 per_pixel() {
 
 void main() {
     tan_fov_2 = tan(fov / 2.0);
+    load_scene_header();
     FragColor = vec4(per_pixel(), 1.0);
 }
@@ -0,0 +1,204 @@
+#include "batch.h"
+#include "bitmap.h"
+#include "framebuffer.h"
+#include "renderer.h"
+#include "scene_file.h"
+#include "tonemap.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Private ---
+
+// Index of the scene loaded from filepath, adding it on first use
+size_t batch_find_scene(batch *b, const char *filepath) {
+    for (size_t i = 0; i < b->num_scenes; i++)
+        if (strcmp(b->scenes[i].path, filepath) == 0)
+            return i;
+
+    if (b->num_scenes == b->max_scenes) {
+        b->max_scenes *= 2;
+        b->scenes = realloc(b->scenes, b->max_scenes * sizeof(batch_scene));
+    }
+    batch_scene *entry = &b->scenes[b->num_scenes];
+    strcpy(entry->path, filepath);
+    entry->loaded = false;
+    return b->num_scenes++;
+}
+
+void batch_load_scenes(void *ctx, size_t begin, size_t end) {
+    batch *b = ctx;
+    for (size_t i = begin; i < end; i++) {
+        batch_scene *entry = &b->scenes[i];
+        int loaded = scene_file_detect(entry->path)
+                         ? scene_file_map(&entry->world, entry->path, 0)
+                         : scene_load(&entry->world, entry->path);
+        if (loaded != 0)
+            continue;
+
+        scene_build_accel(&entry->world);
+        scene_build_lights(&entry->world);
+        entry->loaded = true;
+    }
+}
+
+void batch_render_job(threadpool *pool, batch_job *job) {
+    uint64_t start_ns = monotonic_ns();
+    if (job->world == NULL) {
+        job->failed = true;
+        job->latency_ms = 0;
+        return;
+    }
+
+    // Sample count only, no deadline and no preview nobody will see
+    framebuffer fb;
+    framebuffer_init(&fb, job->width, job->height);
+    progressive_settings settings = {
+        .max_samples = job->samples,
+        .cache = job->cache,
+    };
+    render_progressive(pool, job->world, &job->cam, &fb, &settings);
+
+    uint8_t *pixels = malloc(3 * job->width * job->height);
+    tonemap_settings tone = tonemap_default();
+    tonemap(pool, &fb, &tone, pixels);
+    framebuffer_destroy(&fb);
+
+    job->failed = write_bitmap(job->output_path, job->width, job->height,
+                               pixels, true) != 0;
+    free(pixels);
+    job->latency_ms = (monotonic_ns() - start_ns) / 1e6;
+}
+
+// Small jobs render on a single worker, so the pool works on many at once
+// instead of splitting each one into a handful of tiles
+void batch_small_job_task(batch_job *job) {
+    batch_render_job(NULL, job);
+}
+
+int batch_compare_latency(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+double batch_percentile(const double *sorted, size_t count, double p) {
+    if (count == 0)
+        return 0;
+    size_t rank = ceil(p * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// --- Public ---
+
+void batch_init(batch *b) {
+    b->num_scenes = 0;
+    b->max_scenes = 4;
+    b->scenes = malloc(b->max_scenes * sizeof(batch_scene));
+    b->num_jobs = 0;
+    b->max_jobs = 64;
+    b->jobs = malloc(b->max_jobs * sizeof(batch_job));
+    b->cache = NULL;
+}
+
+void batch_destroy(batch *b) {
+    for (size_t i = 0; i < b->num_scenes; i++)
+        if (b->scenes[i].loaded)
+            scene_destroy(&b->scenes[i].world);
+    free(b->scenes);
+    free(b->jobs);
+}
+
+int batch_load_manifest(batch *b, const char *filepath) {
+    FILE *fp = fopen(filepath, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open file: %s\n", filepath);
+        return -1;
+    }
+
+    char line[1024];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+        const char *start = line;
+        while (isspace((unsigned char)*start))
+            start++;
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        char scene_path[BATCH_PATH_LENGTH];
+        batch_job job = {0};
+        float fov_degrees;
+        if (sscanf(start, "%255s %255s %zu %zu %zu %f %f %f %f", scene_path,
+                   job.output_path, &job.width, &job.height, &job.samples,
+                   &job.cam.position.x, &job.cam.position.y,
+                   &job.cam.position.z, &fov_degrees) != 9 ||
+            job.width == 0 || job.height == 0 || job.samples == 0) {
+            fprintf(stderr, "Invalid job on line %zu of %s\n", line_number,
+                    filepath);
+            fclose(fp);
+            return -1;
+        }
+        job.cam.fov = fov_degrees * M_PI / 180.0f;
+        job.scene_index = batch_find_scene(b, scene_path);
+
+        if (b->num_jobs == b->max_jobs) {
+            b->max_jobs *= 2;
+            b->jobs = realloc(b->jobs, b->max_jobs * sizeof(batch_job));
+        }
+        b->jobs[b->num_jobs++] = job;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int batch_run(batch *b, threadpool *pool, batch_report *report) {
+    uint64_t start_ns = monotonic_ns();
+
+    // Every distinct scene is loaded and its BVH built once, in parallel
+    parallel_for(pool, 0, b->num_scenes, 1, batch_load_scenes, b);
+    for (size_t i = 0; i < b->num_jobs; i++) {
+        batch_scene *entry = &b->scenes[b->jobs[i].scene_index];
+        b->jobs[i].world = entry->loaded ? &entry->world : NULL;
+        b->jobs[i].cache = b->cache;
+    }
+
+    task_group group;
+    task_group_init(&group, pool);
+    for (size_t i = 0; i < b->num_jobs; i++)
+        if (b->jobs[i].width * b->jobs[i].height <= BATCH_SMALL_PIXELS)
+            task_group_add(&group, (void (*)(void *))batch_small_job_task,
+                           &b->jobs[i]);
+
+    // Large jobs are tiled from this thread while the small ones run. Their
+    // tiles are queued last and so taken first as workers free up.
+    for (size_t i = 0; i < b->num_jobs; i++)
+        if (b->jobs[i].width * b->jobs[i].height > BATCH_SMALL_PIXELS)
+            batch_render_job(pool, &b->jobs[i]);
+    task_group_wait(&group);
+
+    double *latencies = malloc(b->num_jobs * sizeof(double));
+    size_t failed = 0;
+    for (size_t i = 0; i < b->num_jobs; i++) {
+        latencies[i] = b->jobs[i].latency_ms;
+        failed += b->jobs[i].failed;
+    }
+    qsort(latencies, b->num_jobs, sizeof(double), batch_compare_latency);
+
+    double elapsed_ms = (monotonic_ns() - start_ns) / 1e6;
+    *report = (batch_report){
+        .jobs = b->num_jobs,
+        .scenes = b->num_scenes,
+        .failed = failed,
+        .elapsed_ms = elapsed_ms,
+        .jobs_per_second =
+            elapsed_ms > 0 ? b->num_jobs / (elapsed_ms / 1000) : 0,
+        .p50_ms = batch_percentile(latencies, b->num_jobs, 0.50),
+        .p99_ms = batch_percentile(latencies, b->num_jobs, 0.99),
+    };
+    free(latencies);
+    return failed > 0 ? -1 : 0;
+}
@@ -2,9 +2,13 @@
 #include "portable_endian.h"
 #include <stdio.h>
 
-void write_bitmap(char *filename, unsigned int imgwidth, unsigned int imgheight,
-                  uint8_t *pixels, bool y_inverted) {
+int write_bitmap(char *filename, unsigned int imgwidth, unsigned int imgheight,
+                 uint8_t *pixels, bool y_inverted) {
     FILE *fptr = fopen(filename, "wb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open file: %s\n", filename);
+        return -1;
+    }
     size_t row_padding = (4 - (imgwidth * 3) % 4) % 4;
 
     // file header
@@ -74,5 +78,9 @@ void write_bitmap(char *filename, unsigned int imgwidth, unsigned int imgheight,
         }
     }
 
-    fclose(fptr);
+    if (fclose(fptr) != 0) {
+        fprintf(stderr, "Failed to write file: %s\n", filename);
+        return -1;
+    }
+    return 0;
 }
@@ -0,0 +1,222 @@
+#include "bvh.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define BVH_BINS 12
+#define BVH_MAX_LEAF_SIZE 4
+
+typedef struct {
+    vec3s min, max;
+    size_t count;
+} bvh_bin;
+
+typedef struct {
+    bvh *b;
+    const vec3s *prim_min;
+    const vec3s *prim_max;
+    vec3s *centroids;
+} bvh_builder;
+
+// --- Private ---
+
+float bvh_surface_area(const vec3s min, const vec3s max) {
+    vec3s extent = glms_vec3_maxv(glms_vec3_sub(max, min), glms_vec3_zero());
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z +
+                   extent.z * extent.x);
+}
+
+void bvh_fit_node(bvh_builder *builder, bvh_node *node) {
+    node->min = glms_vec3_broadcast(INFINITY);
+    node->max = glms_vec3_broadcast(-INFINITY);
+
+    for (uint32_t i = 0; i < node->count; i++) {
+        uint32_t prim = builder->b->indices[node->left_first + i];
+        node->min = glms_vec3_minv(node->min, builder->prim_min[prim]);
+        node->max = glms_vec3_maxv(node->max, builder->prim_max[prim]);
+    }
+}
+
+void bvh_subdivide(bvh_builder *builder, uint32_t node_idx, int depth) {
+    bvh *b = builder->b;
+    bvh_node *node = &b->nodes[node_idx];
+    uint32_t *indices = &b->indices[node->left_first];
+
+    vec3s cmin = glms_vec3_broadcast(INFINITY);
+    vec3s cmax = glms_vec3_broadcast(-INFINITY);
+    for (uint32_t i = 0; i < node->count; i++) {
+        cmin = glms_vec3_minv(cmin, builder->centroids[indices[i]]);
+        cmax = glms_vec3_maxv(cmax, builder->centroids[indices[i]]);
+    }
+
+    // Find the cheapest binned SAH split over all three axes
+    int best_axis = -1;
+    int best_split = 0;
+    float best_cost = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        // Degenerate, subnormal or non-finite extents cannot be binned
+        float extent = cmax.raw[axis] - cmin.raw[axis];
+        float scale = BVH_BINS / extent;
+        if (!(extent > 0) || !isfinite(scale))
+            continue;
+
+        bvh_bin bins[BVH_BINS];
+        for (int i = 0; i < BVH_BINS; i++)
+            bins[i] = (bvh_bin){glms_vec3_broadcast(INFINITY),
+                                glms_vec3_broadcast(-INFINITY), 0};
+
+        for (uint32_t i = 0; i < node->count; i++) {
+            uint32_t prim = indices[i];
+            int bin = (builder->centroids[prim].raw[axis] - cmin.raw[axis]) *
+                      scale;
+            bin = bin < 0 ? 0 : bin >= BVH_BINS ? BVH_BINS - 1 : bin;
+            bins[bin].count++;
+            bins[bin].min =
+                glms_vec3_minv(bins[bin].min, builder->prim_min[prim]);
+            bins[bin].max =
+                glms_vec3_maxv(bins[bin].max, builder->prim_max[prim]);
+        }
+
+        // Sweep from both sides to get the cost of every split plane
+        float left_area[BVH_BINS - 1], right_area[BVH_BINS - 1];
+        size_t left_count[BVH_BINS - 1], right_count[BVH_BINS - 1];
+        bvh_bin left = {glms_vec3_broadcast(INFINITY),
+                        glms_vec3_broadcast(-INFINITY), 0};
+        bvh_bin right = left;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            left.count += bins[i].count;
+            left.min = glms_vec3_minv(left.min, bins[i].min);
+            left.max = glms_vec3_maxv(left.max, bins[i].max);
+            left_count[i] = left.count;
+            left_area[i] = bvh_surface_area(left.min, left.max);
+
+            int j = BVH_BINS - 1 - i;
+            right.count += bins[j].count;
+            right.min = glms_vec3_minv(right.min, bins[j].min);
+            right.max = glms_vec3_maxv(right.max, bins[j].max);
+            right_count[j - 1] = right.count;
+            right_area[j - 1] = bvh_surface_area(right.min, right.max);
+        }
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            if (left_count[i] == 0 || right_count[i] == 0)
+                continue;
+
+            float cost = left_count[i] * left_area[i] +
+                         right_count[i] * right_area[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i + 1;
+            }
+        }
+    }
+
+    // Keep small nodes as leaves unless splitting is cheaper. Nodes at the
+    // depth limit stay leaves so traversal stacks cannot overflow.
+    float leaf_cost = node->count * bvh_surface_area(node->min, node->max);
+    if (best_axis == -1 || depth >= BVH_MAX_DEPTH ||
+        (node->count <= BVH_MAX_LEAF_SIZE && best_cost >= leaf_cost))
+        return;
+
+    // Partition primitives around the split plane
+    float extent = cmax.raw[best_axis] - cmin.raw[best_axis];
+    float split = cmin.raw[best_axis] + extent * best_split / BVH_BINS;
+    uint32_t i = 0, j = node->count;
+    while (i < j) {
+        if (builder->centroids[indices[i]].raw[best_axis] < split) {
+            i++;
+        } else {
+            uint32_t tmp = indices[i];
+            indices[i] = indices[--j];
+            indices[j] = tmp;
+        }
+    }
+    if (i == 0 || i == node->count)
+        return;
+
+    // Create children next to each other
+    uint32_t left_idx = b->num_nodes;
+    b->num_nodes += 2;
+
+    bvh_node *left = &b->nodes[left_idx];
+    bvh_node *right = &b->nodes[left_idx + 1];
+    left->left_first = node->left_first;
+    left->count = i;
+    right->left_first = node->left_first + i;
+    right->count = node->count - i;
+    bvh_fit_node(builder, left);
+    bvh_fit_node(builder, right);
+
+    node->left_first = left_idx;
+    node->count = 0;
+
+    bvh_subdivide(builder, left_idx, depth + 1);
+    bvh_subdivide(builder, left_idx + 1, depth + 1);
+}
+
+// --- Public ---
+
+void bvh_init(bvh *b) {
+    b->nodes = NULL;
+    b->num_nodes = 0;
+    b->indices = NULL;
+    b->num_indices = 0;
+}
+
+void bvh_build(bvh *b, const vec3s *prim_min, const vec3s *prim_max,
+               size_t num_prims) {
+    bvh_destroy(b);
+    if (num_prims == 0)
+        return;
+
+    b->nodes = malloc((2 * num_prims - 1) * sizeof(bvh_node));
+    b->indices = malloc(num_prims * sizeof(uint32_t));
+    b->num_indices = num_prims;
+
+    bvh_builder builder = {
+        .b = b,
+        .prim_min = prim_min,
+        .prim_max = prim_max,
+        .centroids = malloc(num_prims * sizeof(vec3s)),
+    };
+    for (size_t i = 0; i < num_prims; i++) {
+        b->indices[i] = i;
+        builder.centroids[i] =
+            glms_vec3_scale(glms_vec3_add(prim_min[i], prim_max[i]), 0.5f);
+    }
+
+    bvh_node *root = &b->nodes[0];
+    root->left_first = 0;
+    root->count = num_prims;
+    b->num_nodes = 1;
+    bvh_fit_node(&builder, root);
+    bvh_subdivide(&builder, 0, 0);
+
+    free(builder.centroids);
+}
+
+void bvh_destroy(bvh *b) {
+    free(b->nodes);
+    free(b->indices);
+    bvh_init(b);
+}
+
+bool bvh_intersect_node(const bvh_node *node, const vec3s origin,
+                        const vec3s inv_direction, float max_distance,
+                        float *entry_distance) {
+    // Slab test
+    float t_min = 0, t_max = max_distance;
+    for (int axis = 0; axis < 3; axis++) {
+        float t1 = (node->min.raw[axis] - origin.raw[axis]) *
+                   inv_direction.raw[axis];
+        float t2 = (node->max.raw[axis] - origin.raw[axis]) *
+                   inv_direction.raw[axis];
+        t_min = fmaxf(t_min, fminf(t1, t2));
+        t_max = fminf(t_max, fmaxf(t1, t2));
+    }
+
+    *entry_distance = t_min;
+    return t_min <= t_max;
+}
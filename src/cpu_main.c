@@ -0,0 +1,86 @@
+#include "batch.h"
+#include "scene_file.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void print_usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s --serve <socket path> [threads] [resident MB] "
+            "[cache dir]\n"
+            "       %s --batch <manifest> [threads] [cache dir]\n"
+            "       %s --pack <scene file> <packed scene file>\n",
+            program, program, program);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--pack") == 0 && argc > 3) {
+        scene world;
+        if (scene_load(&world, argv[2]) != 0)
+            return 1;
+        int written = scene_file_write(&world, argv[3]);
+        scene_destroy(&world);
+        return written == 0 ? 0 : 1;
+    }
+
+    size_t num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 3)
+        num_threads = strtoul(argv[3], NULL, 10);
+    if (num_threads == 0)
+        num_threads = 1;
+
+    render_cache cache;
+    if (strcmp(argv[1], "--serve") == 0) {
+        if (argc > 5 && render_cache_init(&cache, argv[5]) != 0)
+            return 1;
+        render_server srv;
+        if (render_server_init(&srv, argv[2], num_threads) != 0)
+            return 1;
+        if (argc > 4)
+            srv.resident_budget = strtoull(argv[4], NULL, 10) << 20;
+        if (argc > 5)
+            srv.cache = &cache;
+
+        printf("Listening on %s with %zu threads\n", argv[2], num_threads);
+        render_server_run(&srv);
+        render_server_destroy(&srv);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "--batch") == 0) {
+        if (argc > 4 && render_cache_init(&cache, argv[4]) != 0)
+            return 1;
+        batch b;
+        batch_init(&b);
+        if (batch_load_manifest(&b, argv[2]) != 0) {
+            batch_destroy(&b);
+            return 1;
+        }
+        if (argc > 4)
+            b.cache = &cache;
+
+        threadpool pool;
+        threadpool_init(&pool, num_threads);
+        batch_report report;
+        int ran = batch_run(&b, &pool, &report);
+        threadpool_destroy(&pool);
+        batch_destroy(&b);
+
+        printf("%zu jobs over %zu scenes in %.3f s, %zu failed\n"
+               "%.1f jobs/s, latency p50 %.3f ms, p99 %.3f ms\n",
+               report.jobs, report.scenes, report.elapsed_ms / 1000,
+               report.failed, report.jobs_per_second, report.p50_ms,
+               report.p99_ms);
+        return ran == 0 ? 0 : 1;
+    }
+
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,58 @@
+#include "framebuffer.h"
+#include <cglm/struct.h>
+#include <stdlib.h>
+
+void framebuffer_init(framebuffer *fb, size_t width, size_t height) {
+    fb->width = width;
+    fb->height = height;
+    fb->color = calloc(width * height, sizeof(vec3s));
+    fb->samples = calloc(width * height, sizeof(uint32_t));
+    fb->preview = calloc(width * height, sizeof(vec3s));
+}
+
+void framebuffer_clear(framebuffer *fb) {
+    for (size_t i = 0; i < fb->width * fb->height; i++) {
+        fb->color[i] = glms_vec3_zero();
+        fb->samples[i] = 0;
+        fb->preview[i] = glms_vec3_zero();
+    }
+}
+
+void framebuffer_destroy(framebuffer *fb) {
+    free(fb->color);
+    free(fb->samples);
+    free(fb->preview);
+}
+
+void framebuffer_add_sample(framebuffer *fb, size_t x, size_t y,
+                            const vec3s sample) {
+    // Radiance stays unbounded for tone mapping, only fireflies are cut
+    size_t idx = y * fb->width + x;
+    fb->color[idx] = glms_vec3_add(
+        fb->color[idx], glms_vec3_clamp(sample, 0, FRAMEBUFFER_MAX_SAMPLE));
+    fb->samples[idx]++;
+}
+
+vec3s framebuffer_get(const framebuffer *fb, size_t x, size_t y) {
+    size_t idx = y * fb->width + x;
+
+    // Fall back to the preview until the pixel has been sampled
+    if (fb->samples[idx] == 0)
+        return fb->preview[idx];
+    return glms_vec3_scale(fb->color[idx], 1.0f / fb->samples[idx]);
+}
+
+uint32_t framebuffer_min_samples(const framebuffer *fb) {
+    framebuffer_region full = {0, 0, fb->width, fb->height};
+    return framebuffer_region_min_samples(fb, &full);
+}
+
+uint32_t framebuffer_region_min_samples(const framebuffer *fb,
+                                        const framebuffer_region *region) {
+    uint32_t min = UINT32_MAX;
+    for (size_t y = region->y0; y < region->y1; y++)
+        for (size_t x = region->x0; x < region->x1; x++)
+            if (fb->samples[y * fb->width + x] < min)
+                min = fb->samples[y * fb->width + x];
+    return min == UINT32_MAX ? 0 : min;
+}
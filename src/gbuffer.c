@@ -0,0 +1,64 @@
+#include "gbuffer.h"
+#include <cglm/struct.h>
+#include <stdlib.h>
+
+void gbuffer_init(gbuffer *g) {
+    g->width = 0;
+    g->height = 0;
+    g->texels = NULL;
+    g->geometry_hash = 0;
+}
+
+void gbuffer_destroy(gbuffer *g) {
+    free(g->texels);
+    gbuffer_init(g);
+}
+
+// Returns true when hits cached by an earlier render are still valid
+bool gbuffer_prepare(gbuffer *g, const scene *world, const camera *cam,
+                     size_t width, size_t height) {
+    uint64_t geometry_hash = scene_geometry_hash(world);
+
+    if (g->texels != NULL && g->width == width && g->height == height &&
+        g->geometry_hash == geometry_hash &&
+        glms_vec3_eqv(g->cam.position, cam->position) &&
+        g->cam.fov == cam->fov)
+        return true;
+
+    // Geometry, camera or resolution changed, start capturing again
+    free(g->texels);
+    g->width = width;
+    g->height = height;
+    g->texels = calloc(width * height, sizeof(gbuffer_texel));
+    g->geometry_hash = geometry_hash;
+    g->cam = *cam;
+    return false;
+}
+
+void gbuffer_store(gbuffer_texel *texel, const ray_hit *hit) {
+    if (hit->distance < 0) {
+        texel->state = GBUFFER_MISS;
+        return;
+    }
+
+    texel->distance = hit->distance;
+    texel->normal = hit->normal;
+    texel->primitive = hit->primitive;
+    texel->material = hit->material;
+    texel->state = GBUFFER_HIT;
+}
+
+ray_hit gbuffer_hit(const gbuffer_texel *texel, const camera *cam,
+                    const vec3s direction) {
+    if (texel->state != GBUFFER_HIT)
+        return (ray_hit){.distance = -1};
+
+    return (ray_hit){
+        .distance = texel->distance,
+        .point = glms_vec3_add(cam->position,
+                               glms_vec3_scale(direction, texel->distance)),
+        .normal = texel->normal,
+        .primitive = texel->primitive,
+        .material = texel->material,
+    };
+}
@@ -0,0 +1,139 @@
+#include "gpu/scene_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_RECORD_TEXELS 3
+
+// --- Private ---
+
+void scene_buffer_set_float(uint8_t *record, size_t component, float value) {
+    memcpy(record + component * sizeof(float), &value, sizeof(float));
+}
+
+void scene_buffer_set_int(uint8_t *record, size_t component, int32_t value) {
+    memcpy(record + component * sizeof(int32_t), &value, sizeof(int32_t));
+}
+
+void scene_buffer_set_vec3(uint8_t *record, size_t texel, const vec3s v) {
+    for (size_t i = 0; i < 3; i++)
+        scene_buffer_set_float(record, 4 * texel + i, v.raw[i]);
+}
+
+// Copy a record into the buffer, growing the dirty range if it changed
+void scene_buffer_write(scene_buffer *buf, size_t texel, const uint8_t *record,
+                        size_t num_texels) {
+    size_t offset = texel * SCENE_BUFFER_TEXEL_SIZE;
+    size_t size = num_texels * SCENE_BUFFER_TEXEL_SIZE;
+    if (memcmp(buf->data + offset, record, size) == 0)
+        return;
+
+    memcpy(buf->data + offset, record, size);
+    if (buf->dirty_begin == buf->dirty_end) {
+        buf->dirty_begin = offset;
+        buf->dirty_end = offset + size;
+        return;
+    }
+    if (offset < buf->dirty_begin)
+        buf->dirty_begin = offset;
+    if (offset + size > buf->dirty_end)
+        buf->dirty_end = offset + size;
+}
+
+// --- Public ---
+
+void scene_buffer_init(scene_buffer *buf) {
+    buf->data = NULL;
+    buf->size = 0;
+    buf->capacity = 0;
+    buf->dirty_begin = 0;
+    buf->dirty_end = 0;
+    buf->resized = false;
+}
+
+void scene_buffer_destroy(scene_buffer *buf) { free(buf->data); }
+
+void scene_buffer_pack(scene_buffer *buf, const scene *world) {
+    size_t material_offset = SCENE_BUFFER_HEADER_TEXELS;
+    size_t sphere_offset = material_offset + world->num_materials *
+                                                 SCENE_BUFFER_MATERIAL_TEXELS;
+    size_t triangle_offset =
+        sphere_offset + world->num_spheres * SCENE_BUFFER_SPHERE_TEXELS;
+    size_t num_texels =
+        triangle_offset + world->num_triangles * SCENE_BUFFER_TRIANGLE_TEXELS;
+    size_t size = num_texels * SCENE_BUFFER_TEXEL_SIZE;
+
+    // A different layout invalidates everything previously uploaded
+    if (size != buf->size) {
+        if (size > buf->capacity) {
+            buf->capacity = size;
+            buf->data = realloc(buf->data, buf->capacity);
+        }
+        memset(buf->data, 0, size);
+        buf->size = size;
+        buf->resized = true;
+        buf->dirty_begin = 0;
+        buf->dirty_end = size;
+    }
+
+    uint8_t record[MAX_RECORD_TEXELS * SCENE_BUFFER_TEXEL_SIZE];
+
+    // Header
+    memset(record, 0, sizeof(record));
+    scene_buffer_set_int(record, 0, world->num_materials);
+    scene_buffer_set_int(record, 1, world->num_spheres);
+    scene_buffer_set_int(record, 2, world->num_triangles);
+    scene_buffer_set_int(record, 4, material_offset);
+    scene_buffer_set_int(record, 5, sphere_offset);
+    scene_buffer_set_int(record, 6, triangle_offset);
+    scene_buffer_write(buf, 0, record, SCENE_BUFFER_HEADER_TEXELS);
+
+    for (size_t i = 0; i < world->num_materials; i++) {
+        const shape_material *mat = &world->materials[i];
+
+        memset(record, 0, sizeof(record));
+        scene_buffer_set_vec3(record, 0, mat->albedo);
+        scene_buffer_set_float(record, 3, mat->roughness);
+        scene_buffer_set_vec3(record, 1, mat->emission_color);
+        scene_buffer_set_float(record, 7, mat->emission_strength);
+        scene_buffer_set_float(record, 8, mat->metallicity);
+        scene_buffer_set_float(record, 9, mat->transparency);
+        scene_buffer_set_float(record, 10, mat->refractive_index);
+        scene_buffer_write(
+            buf, material_offset + i * SCENE_BUFFER_MATERIAL_TEXELS, record,
+            SCENE_BUFFER_MATERIAL_TEXELS);
+    }
+
+    for (size_t i = 0; i < world->num_spheres; i++) {
+        const sphere *sph = &world->spheres[i];
+
+        memset(record, 0, sizeof(record));
+        scene_buffer_set_vec3(record, 0, sph->center);
+        scene_buffer_set_float(record, 3, sph->radius);
+        scene_buffer_set_int(record, 4, world->sphere_materials[i]);
+        scene_buffer_write(buf, sphere_offset + i * SCENE_BUFFER_SPHERE_TEXELS,
+                           record, SCENE_BUFFER_SPHERE_TEXELS);
+    }
+
+    for (size_t i = 0; i < world->num_triangles; i++) {
+        const triangle *tri = &world->triangles[i];
+
+        memset(record, 0, sizeof(record));
+        scene_buffer_set_vec3(record, 0, tri->v0);
+        scene_buffer_set_int(record, 3, world->triangle_materials[i]);
+        scene_buffer_set_vec3(record, 1, tri->v1);
+        scene_buffer_set_vec3(record, 2, tri->v2);
+        scene_buffer_write(
+            buf, triangle_offset + i * SCENE_BUFFER_TRIANGLE_TEXELS, record,
+            SCENE_BUFFER_TRIANGLE_TEXELS);
+    }
+}
+
+bool scene_buffer_dirty(const scene_buffer *buf) {
+    return buf->resized || buf->dirty_begin != buf->dirty_end;
+}
+
+void scene_buffer_mark_clean(scene_buffer *buf) {
+    buf->dirty_begin = 0;
+    buf->dirty_end = 0;
+    buf->resized = false;
+}
@@ -0,0 +1,209 @@
+#include "guiding.h"
+#include "sampling.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GUIDING_CELLS                                                          \
+    (GUIDING_RESOLUTION * GUIDING_RESOLUTION * GUIDING_RESOLUTION)
+#define GUIDING_FRACTION 0.5f   // Share of bounces drawn from the histogram
+#define GUIDING_MAX_RECORD 16.0f // Keeps rare bright paths from dominating
+#define GUIDING_MIN_RECORDS 32   // Fewer lit paths than this stay unguided
+
+// --- Private ---
+
+// Index in [0, count), also mapping NaN to 0
+size_t guiding_index(float value, size_t count) {
+    if (!(value > 0))
+        return 0;
+    return value < count - 1 ? (size_t)value : count - 1;
+}
+
+size_t guiding_cell(const guiding *g, const vec3s point) {
+    size_t cell = 0;
+    for (int axis = 2; axis >= 0; axis--) {
+        float offset = point.raw[axis] - g->min.raw[axis];
+        cell = cell * GUIDING_RESOLUTION +
+               guiding_index(offset * g->cell_scale.raw[axis],
+                             GUIDING_RESOLUTION);
+    }
+    return cell;
+}
+
+// Cylindrical mapping, equal area so every bin covers the same solid angle
+size_t guiding_bin(const vec3s direction) {
+    float phi = atan2f(direction.y, direction.x);
+    size_t theta_bin = guiding_index((direction.z + 1) * 0.5f *
+                                         GUIDING_THETA_BINS,
+                                     GUIDING_THETA_BINS);
+    size_t phi_bin = guiding_index((phi + M_PI) / (2 * M_PI) *
+                                       GUIDING_PHI_BINS,
+                                   GUIDING_PHI_BINS);
+    return theta_bin * GUIDING_PHI_BINS + phi_bin;
+}
+
+vec3s guiding_bin_direction(size_t bin, float u1, float u2) {
+    size_t theta = bin / GUIDING_PHI_BINS, phi_bin = bin % GUIDING_PHI_BINS;
+    float z = -1 + 2 * (theta + u1) / GUIDING_THETA_BINS;
+    float phi = -M_PI + 2 * M_PI * (phi_bin + u2) / GUIDING_PHI_BINS;
+    float r = sqrtf(fmaxf(0, 1 - z * z));
+    return (vec3s){r * cosf(phi), r * sinf(phi), z};
+}
+
+vec3s guiding_cosine_direction(const vec3s normal, float u1, float u2) {
+    vec3s helper =
+        fabsf(normal.x) > 0.9f ? (vec3s){0, 1, 0} : (vec3s){1, 0, 0};
+    vec3s tangent = glms_vec3_normalize(glms_vec3_cross(helper, normal));
+    vec3s bitangent = glms_vec3_cross(normal, tangent);
+
+    vec3s local = sampling_cosine_hemisphere_one(u1, u2);
+    return glms_vec3_add(
+        glms_vec3_scale(normal, local.z),
+        glms_vec3_add(glms_vec3_scale(tangent, local.x),
+                      glms_vec3_scale(bitangent, local.y)));
+}
+
+// Compare-exchange loop, a plain += on an atomic float needs libatomic
+void guiding_atomic_add(_Atomic float *target, float value) {
+    float expected = atomic_load_explicit(target, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(target, &expected,
+                                                  expected + value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+void guiding_finalize(guiding *g) {
+    for (size_t cell = 0; cell < GUIDING_CELLS; cell++) {
+        _Atomic float *energy = &g->energy[cell * GUIDING_BINS];
+        float *cdf = &g->cdf[cell * GUIDING_BINS];
+
+        float total = 0;
+        for (size_t i = 0; i < GUIDING_BINS; i++)
+            total += energy[i];
+        g->trained[cell] = total > 0 && g->records[cell] >= GUIDING_MIN_RECORDS;
+        if (!g->trained[cell])
+            continue;
+
+        float running = 0;
+        for (size_t i = 0; i < GUIDING_BINS; i++) {
+            running += energy[i];
+            cdf[i] = running / total;
+        }
+        cdf[GUIDING_BINS - 1] = 1;
+    }
+}
+
+// --- Public ---
+
+void guiding_init(guiding *g) {
+    g->energy = NULL;
+    g->records = NULL;
+    g->cdf = NULL;
+    g->trained = NULL;
+    g->geometry_hash = 0;
+    g->passes = 0;
+    g->next_fit = GUIDING_TRAINING_PASSES;
+    g->ready = false;
+}
+
+void guiding_destroy(guiding *g) {
+    free(g->energy);
+    free(g->records);
+    free(g->cdf);
+    free(g->trained);
+    guiding_init(g);
+}
+
+void guiding_prepare(guiding *g, const scene *world) {
+    uint64_t geometry_hash = scene_geometry_hash(world);
+    if (g->energy != NULL && g->geometry_hash == geometry_hash)
+        return;
+
+    // Geometry changed, learn from scratch
+    size_t num_bins = GUIDING_CELLS * GUIDING_BINS;
+    if (g->energy == NULL) {
+        g->energy = malloc(num_bins * sizeof(_Atomic float));
+        g->records = malloc(GUIDING_CELLS * sizeof(atomic_uint));
+        g->cdf = malloc(num_bins * sizeof(float));
+        g->trained = malloc(GUIDING_CELLS * sizeof(bool));
+    }
+    for (size_t i = 0; i < num_bins; i++)
+        atomic_init(&g->energy[i], 0);
+    for (size_t i = 0; i < GUIDING_CELLS; i++)
+        atomic_init(&g->records[i], 0);
+    memset(g->trained, 0, GUIDING_CELLS * sizeof(bool));
+
+    vec3s max;
+    scene_bounds(world, &g->min, &max);
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = max.raw[axis] - g->min.raw[axis];
+        g->cell_scale.raw[axis] = extent > 0 ? GUIDING_RESOLUTION / extent : 0;
+    }
+
+    g->geometry_hash = geometry_hash;
+    g->passes = 0;
+    g->next_fit = GUIDING_TRAINING_PASSES;
+    g->ready = false;
+}
+
+void guiding_record(guiding *g, const vec3s point, const vec3s direction,
+                    const vec3s radiance) {
+    float luminance = 0.2126f * radiance.r + 0.7152f * radiance.g +
+                      0.0722f * radiance.b;
+    if (!(luminance > 0))
+        return;
+
+    size_t cell = guiding_cell(g, point);
+    guiding_atomic_add(&g->energy[cell * GUIDING_BINS + guiding_bin(direction)],
+                       fminf(luminance, GUIDING_MAX_RECORD));
+    atomic_fetch_add_explicit(&g->records[cell], 1, memory_order_relaxed);
+}
+
+void guiding_end_pass(guiding *g) {
+    if (++g->passes < g->next_fit)
+        return;
+
+    // Records keep accumulating, each fit sees twice the data of the last
+    guiding_finalize(g);
+    g->ready = true;
+    g->next_fit *= 2;
+}
+
+float guiding_sample(const guiding *g, const vec3s point, const vec3s normal,
+                     float u0, float u1, float u2, vec3s *direction) {
+    size_t cell = guiding_cell(g, point);
+    const float *cdf = &g->cdf[cell * GUIDING_BINS];
+    bool guided = g->trained[cell];
+
+    if (guided && u0 < GUIDING_FRACTION) {
+        // Binary search for the bin u0 falls into
+        u0 /= GUIDING_FRACTION;
+        size_t lo = 0, hi = GUIDING_BINS - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] > u0)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        *direction = guiding_bin_direction(lo, u1, u2);
+    } else {
+        *direction = guiding_cosine_direction(normal, u1, u2);
+    }
+
+    float cos_theta = glms_vec3_dot(normal, *direction);
+    if (cos_theta <= 0)
+        return 0;
+
+    // One-sample mixture of both strategies
+    float pdf = cos_theta / M_PI;
+    if (guided) {
+        size_t bin = guiding_bin(*direction);
+        float bin_probability = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0);
+        float guided_pdf = bin_probability * GUIDING_BINS / (4 * M_PI);
+        pdf = GUIDING_FRACTION * guided_pdf + (1 - GUIDING_FRACTION) * pdf;
+    }
+    return cos_theta / (M_PI * pdf);
+}
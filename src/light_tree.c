@@ -0,0 +1,260 @@
+#include "light_tree.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct {
+    vec3s axis;
+    float theta_o;
+    bool omni;
+} light_cone;
+
+// --- Private ---
+
+vec3s light_centroid(const light_info *light) {
+    return glms_vec3_scale(glms_vec3_add(light->min, light->max), 0.5f);
+}
+
+// Smallest cone containing both cones, angles in radians
+light_cone light_cone_union(light_cone a, light_cone b) {
+    if (a.omni || b.omni)
+        return (light_cone){.omni = true};
+    if (b.theta_o > a.theta_o) {
+        light_cone tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    float theta_d = acosf(fminf(fmaxf(glms_vec3_dot(a.axis, b.axis), -1), 1));
+    if (fminf(theta_d + b.theta_o, M_PI) <= a.theta_o)
+        return a;
+
+    float theta_o = (a.theta_o + theta_d + b.theta_o) / 2;
+    if (theta_o >= M_PI)
+        return (light_cone){.omni = true};
+
+    // Rotate a's axis towards b's to centre the new cone
+    float theta_r = theta_o - a.theta_o;
+    vec3s rotation_axis = glms_vec3_cross(a.axis, b.axis);
+    if (glms_vec3_norm2(rotation_axis) < 1e-12f)
+        return (light_cone){.omni = true};
+    rotation_axis = glms_vec3_normalize(rotation_axis);
+
+    // Rodrigues rotation of a.axis about rotation_axis by theta_r
+    vec3s axis = glms_vec3_add(
+        glms_vec3_scale(a.axis, cosf(theta_r)),
+        glms_vec3_scale(glms_vec3_cross(rotation_axis, a.axis), sinf(theta_r)));
+    return (light_cone){
+        .axis = glms_vec3_normalize(axis),
+        .theta_o = theta_o,
+    };
+}
+
+uint32_t light_tree_subdivide(light_tree *t, light_info *lights, size_t first,
+                              size_t count, light_cone *cone) {
+    uint32_t node_idx = t->num_nodes++;
+    light_node *node = &t->nodes[node_idx];
+
+    if (count == 1) {
+        const light_info *light = &lights[first];
+        *cone = (light_cone){
+            .axis = light->axis,
+            .theta_o = 0,
+            .omni = light->omni,
+        };
+        *node = (light_node){
+            .min = light->min,
+            .max = light->max,
+            .axis = light->axis,
+            .cos_theta_o = light->omni ? -1 : 1,
+            .power = light->power,
+            .right_or_light = first,
+            .leaf = true,
+            .two_sided = light->two_sided,
+        };
+        t->lights[first] = light->primitive;
+        return node_idx;
+    }
+
+    // Median split along the widest axis of the centroids keeps the depth
+    // logarithmic in the number of lights
+    vec3s cmin = glms_vec3_broadcast(INFINITY);
+    vec3s cmax = glms_vec3_broadcast(-INFINITY);
+    for (size_t i = first; i < first + count; i++) {
+        cmin = glms_vec3_minv(cmin, light_centroid(&lights[i]));
+        cmax = glms_vec3_maxv(cmax, light_centroid(&lights[i]));
+    }
+    vec3s extent = glms_vec3_sub(cmax, cmin);
+    int axis = 0;
+    if (extent.y > extent.raw[axis])
+        axis = 1;
+    if (extent.z > extent.raw[axis])
+        axis = 2;
+
+    // Quickselect the median
+    size_t mid = first + count / 2;
+    size_t lo = first, hi = first + count - 1;
+    while (lo < hi) {
+        light_info tmp = lights[(lo + hi) / 2];
+        lights[(lo + hi) / 2] = lights[hi];
+        lights[hi] = tmp;
+        float pivot = light_centroid(&lights[hi]).raw[axis];
+
+        size_t store = lo;
+        for (size_t i = lo; i < hi; i++) {
+            if (light_centroid(&lights[i]).raw[axis] < pivot) {
+                tmp = lights[i];
+                lights[i] = lights[store];
+                lights[store++] = tmp;
+            }
+        }
+        tmp = lights[store];
+        lights[store] = lights[hi];
+        lights[hi] = tmp;
+
+        if (store == mid)
+            break;
+        if (mid < store)
+            hi = store - 1;
+        else
+            lo = store + 1;
+    }
+
+    // Left subtree directly follows its parent
+    light_cone left_cone, right_cone;
+    uint32_t left = light_tree_subdivide(t, lights, first, mid - first,
+                                         &left_cone);
+    uint32_t right = light_tree_subdivide(t, lights, mid, first + count - mid,
+                                          &right_cone);
+    node = &t->nodes[node_idx];
+    const light_node *l = &t->nodes[left], *r = &t->nodes[right];
+
+    // Two-sided emitters may use either orientation of their axis
+    node->two_sided = l->two_sided && r->two_sided;
+    if (node->two_sided && !left_cone.omni && !right_cone.omni &&
+        glms_vec3_dot(left_cone.axis, right_cone.axis) < 0)
+        right_cone.axis = glms_vec3_negate(right_cone.axis);
+    if (l->two_sided != r->two_sided)
+        *cone = (light_cone){.omni = true};
+    else
+        *cone = light_cone_union(left_cone, right_cone);
+
+    node->min = glms_vec3_minv(l->min, r->min);
+    node->max = glms_vec3_maxv(l->max, r->max);
+    node->axis = cone->axis;
+    node->cos_theta_o = cone->omni ? -1 : cosf(cone->theta_o);
+    node->power = l->power + r->power;
+    node->right_or_light = right;
+    node->leaf = false;
+    return node_idx;
+}
+
+// Estimated contribution of everything below the node to a shading point
+float light_node_importance(const light_node *node, const vec3s point,
+                            const vec3s normal) {
+    vec3s center = glms_vec3_scale(glms_vec3_add(node->min, node->max), 0.5f);
+    float radius = glms_vec3_distance(node->max, center);
+
+    vec3s to_light = glms_vec3_sub(center, point);
+    float dist2 = glms_vec3_norm2(to_light);
+
+    // Points inside the bounds get no orientation or distance bounds
+    if (dist2 <= radius * radius)
+        return node->power / fmaxf(radius * radius, 1e-6f);
+    float dist = sqrtf(dist2);
+    vec3s direction = glms_vec3_scale(to_light, 1.0f / dist);
+    float sin_theta_u = radius / dist;
+    float cos_theta_u = sqrtf(1 - sin_theta_u * sin_theta_u);
+
+    // Receiver term: cos(max(0, theta_i - theta_u))
+    float cos_theta_i = glms_vec3_dot(normal, direction);
+    float sin_theta_i = sqrtf(fmaxf(0, 1 - cos_theta_i * cos_theta_i));
+    float cos_receiver = cos_theta_i >= cos_theta_u
+                             ? 1
+                             : cos_theta_i * cos_theta_u +
+                                   sin_theta_i * sin_theta_u;
+    if (cos_receiver <= 0)
+        return 0;
+
+    // Emitter term: cos(max(0, theta - theta_o - theta_u))
+    float cos_emitter = 1;
+    if (node->cos_theta_o > -1) {
+        float cos_theta = -glms_vec3_dot(node->axis, direction);
+        if (node->two_sided)
+            cos_theta = fabsf(cos_theta);
+        float theta = acosf(fminf(fmaxf(cos_theta, -1), 1));
+        float theta_o = acosf(node->cos_theta_o);
+        float theta_prime = fmaxf(0, theta - theta_o - asinf(sin_theta_u));
+        if (theta_prime >= M_PI / 2)
+            return 0;
+        cos_emitter = cosf(theta_prime);
+    }
+
+    return node->power * cos_emitter * cos_receiver / dist2;
+}
+
+// --- Public ---
+
+void light_tree_init(light_tree *t) {
+    t->nodes = NULL;
+    t->num_nodes = 0;
+    t->lights = NULL;
+    t->num_lights = 0;
+}
+
+void light_tree_build(light_tree *t, light_info *lights, size_t num_lights) {
+    light_tree_destroy(t);
+    if (num_lights == 0)
+        return;
+
+    t->nodes = malloc((2 * num_lights - 1) * sizeof(light_node));
+    t->lights = malloc(num_lights * sizeof(uint32_t));
+    t->num_lights = num_lights;
+
+    light_cone cone;
+    light_tree_subdivide(t, lights, 0, num_lights, &cone);
+}
+
+void light_tree_destroy(light_tree *t) {
+    free(t->nodes);
+    free(t->lights);
+    light_tree_init(t);
+}
+
+bool light_tree_sample(const light_tree *t, const vec3s point,
+                       const vec3s normal, float u, uint32_t *primitive,
+                       float *pmf) {
+    if (t->num_nodes == 0)
+        return false;
+
+    // Descend choosing children in proportion to their importance
+    *pmf = 1;
+    uint32_t node_idx = 0;
+    while (!t->nodes[node_idx].leaf) {
+        uint32_t left = node_idx + 1;
+        uint32_t right = t->nodes[node_idx].right_or_light;
+        float left_importance =
+            light_node_importance(&t->nodes[left], point, normal);
+        float right_importance =
+            light_node_importance(&t->nodes[right], point, normal);
+
+        float total = left_importance + right_importance;
+        if (total <= 0)
+            return false;
+
+        float left_probability = left_importance / total;
+        if (u < left_probability) {
+            u /= left_probability;
+            *pmf *= left_probability;
+            node_idx = left;
+        } else {
+            u = (u - left_probability) / (1 - left_probability);
+            *pmf *= 1 - left_probability;
+            node_idx = right;
+        }
+        u = fminf(u, 0x1.fffffep-1f);
+    }
+
+    *primitive = t->lights[t->nodes[node_idx].right_or_light];
+    return true;
+}
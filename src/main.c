@@ -1,11 +1,11 @@
 #include "bitmap.h"
+#include "gpu/scene_buffer.h"
 #include "gpu/shader.h"
 #include "scene.h"
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <time.h>
 
 #define GLFW_INCLUDE_NONE
@@ -21,118 +21,21 @@ void error_callback(int error, const char *description) {
     fprintf(stderr, "Error: %s\n", description);
 }
 
-void uniform_materials(scene *world, int program) {
-    glUseProgram(program);
-
-    for (int i = 0; i < world->num_materials; i++) {
-        shape_material mat = world->materials[i];
-
-        char identifier[32];
-        sprintf(identifier, "materials[%d].", i);
-
-        char albedo[64];
-        strcpy(albedo, identifier);
-        strcat(albedo, "albedo");
-        glUniform3fv(glGetUniformLocation(program, albedo), 1, mat.albedo.raw);
-
-        char roughness[64];
-        strcpy(roughness, identifier);
-        strcat(roughness, "roughness");
-        glUniform1f(glGetUniformLocation(program, roughness), mat.roughness);
-
-        char metallicity[64];
-        strcpy(metallicity, identifier);
-        strcat(metallicity, "metallicity");
-        glUniform1f(glGetUniformLocation(program, metallicity),
-                    mat.metallicity);
-
-        char emission_color[64];
-        strcpy(emission_color, identifier);
-        strcat(emission_color, "emission_color");
-        glUniform3fv(glGetUniformLocation(program, emission_color), 1,
-                     mat.emission_color.raw);
-
-        char emission_strength[64];
-        strcpy(emission_strength, identifier);
-        strcat(emission_strength, "emission_strength");
-        glUniform1f(glGetUniformLocation(program, emission_strength),
-                    mat.emission_strength);
-
-        char transparency[64];
-        strcpy(transparency, identifier);
-        strcat(transparency, "transparency");
-        glUniform1f(glGetUniformLocation(program, transparency),
-                    mat.transparency);
-
-        char refractive_index[64];
-        strcpy(refractive_index, identifier);
-        strcat(refractive_index, "refractive_index");
-        glUniform1f(glGetUniformLocation(program, refractive_index),
-                    mat.refractive_index);
-    }
-}
-
-void uniform_objects(scene *world, int program) {
-    glUseProgram(program);
-
-    int spheres = 0;
-    int triangles = 0;
-    for (int i = 0; i < world->num_objects; i++) {
-        shape obj = world->objects[i];
-        char identifier[32];
-
-        switch (obj.tag) {
-        case SPHERE: {
-            sprintf(identifier, "spheres[%d].", spheres);
-
-            char center[64];
-            strcpy(center, identifier);
-            strcat(center, "center");
-            glUniform3fv(glGetUniformLocation(program, center), 1,
-                         obj.sphere.center.raw);
-
-            char radius[64];
-            strcpy(radius, identifier);
-            strcat(radius, "radius");
-            glUniform1f(glGetUniformLocation(program, radius),
-                        obj.sphere.radius);
-
-            spheres++;
-            break;
-        }
-        case TRIANGLE: {
-            sprintf(identifier, "triangles[%d].", triangles);
-
-            char v0[64];
-            strcpy(v0, identifier);
-            strcat(v0, "v0");
-            glUniform3fv(glGetUniformLocation(program, v0), 1,
-                         obj.triangle.v0.raw);
-
-            char v1[64];
-            strcpy(v1, identifier);
-            strcat(v1, "v1");
-            glUniform3fv(glGetUniformLocation(program, v1), 1,
-                         obj.triangle.v1.raw);
-
-            char v2[64];
-            strcpy(v2, identifier);
-            strcat(v2, "v2");
-            glUniform3fv(glGetUniformLocation(program, v2), 1,
-                         obj.triangle.v2.raw);
-
-            triangles++;
-            break;
-        }
-        }
-
-        char material[64];
-        strcpy(material, identifier);
-        strcat(material, "material");
-        glUniform1i(glGetUniformLocation(program, material), obj.material);
-    }
-    glUniform1i(glGetUniformLocation(program, "sphere_count"), spheres);
-    glUniform1i(glGetUniformLocation(program, "triangle_count"), triangles);
+// Send the changed part of the packed scene to the texture buffer
+void upload_scene(scene_buffer *buf, GLuint tbo) {
+    if (!scene_buffer_dirty(buf))
+        return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, tbo);
+    if (buf->resized)
+        glBufferData(GL_TEXTURE_BUFFER, buf->size, buf->data, GL_DYNAMIC_DRAW);
+    else
+        glBufferSubData(GL_TEXTURE_BUFFER, buf->dirty_begin,
+                        buf->dirty_end - buf->dirty_begin,
+                        buf->data + buf->dirty_begin);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    scene_buffer_mark_clean(buf);
 }
 
 int main() {
@@ -176,6 +79,8 @@ int main() {
     int aspect_ratio_loc = glGetUniformLocation(shader, "aspect_ratio");
     int fov_loc = glGetUniformLocation(shader, "fov");
     int sky_color_loc = glGetUniformLocation(shader, "sky_color");
+    int scene_data_loc = glGetUniformLocation(shader, "scene_data");
+    int scene_ints_loc = glGetUniformLocation(shader, "scene_ints");
 
     // Create vertex array and buffer
     GLuint vao;
@@ -203,7 +108,7 @@ int main() {
     scene_init(&world);
 
     /*world.sky_color = (vec3s){135.0 / 255.0, 206.0 / 255.0, 235.0 / 255.0};*/
-    world.sky_color = glms_vec3_broadcast(0.0);
+    scene_set_sky(&world, glms_vec3_broadcast(0.0));
 
     int sun =
         scene_add_material(&world, (vec3s){0.9372, 0.7490, 0.0157}, 0.3, 1.0,
@@ -241,11 +146,30 @@ int main() {
                        (vec3s){5, -2.5, -10}, mirror);
                        */
 
-    glUseProgram(shader);
+    // Create texture buffer holding the packed scene, viewed once as floats
+    // and once as integers so indices are never read as denormal floats
+    GLuint scene_tbo, scene_texture, scene_int_texture;
+    glGenBuffers(1, &scene_tbo);
+    glGenTextures(1, &scene_texture);
+    glGenTextures(1, &scene_int_texture);
+
+    scene_buffer packed_scene;
+    scene_buffer_init(&packed_scene);
 
     // Send materials and objects to GPU
-    uniform_materials(&world, shader);
-    uniform_objects(&world, shader);
+    scene_buffer_pack(&packed_scene, &world);
+    upload_scene(&packed_scene, scene_tbo);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, scene_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, scene_tbo);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, scene_int_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, scene_tbo);
+
+    glUseProgram(shader);
+    glUniform1i(scene_data_loc, 0);
+    glUniform1i(scene_ints_loc, 1);
 
 #ifdef RT
 
@@ -257,10 +181,11 @@ int main() {
         double delta_time = time - prevTime;
         /*printf("%f\n", time);*/
 
-        /*world.objects[1].sphere.center.x = 1.2 * cos(0.4 * time) - 1.0;*/
-        /*world.objects[1].sphere.center.z = 1.2 * sin(0.4 * time) + 5.0;*/
-        /*world.objects[1].sphere.radius += 0.1 * delta_time;*/
-        uniform_objects(&world, shader);
+        /*world.spheres[1].center.x = 1.2 * cos(0.4 * time) - 1.0;*/
+        /*world.spheres[1].center.z = 1.2 * sin(0.4 * time) + 5.0;*/
+        /*world.spheres[1].radius += 0.1 * delta_time;*/
+        scene_buffer_pack(&packed_scene, &world);
+        upload_scene(&packed_scene, scene_tbo);
 
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
@@ -336,6 +261,12 @@ int main() {
 #endif
 
     // Cleanup
+    glDeleteTextures(1, &scene_texture);
+    glDeleteTextures(1, &scene_int_texture);
+    glDeleteBuffers(1, &scene_tbo);
+    scene_buffer_destroy(&packed_scene);
+    scene_destroy(&world);
+
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -1,73 +1,320 @@
 #include "ray.h"
 #include <cglm/struct.h>
+#include <math.h>
+
+// Depth-first stacks hold the pending siblings of each level on the path
+#define BVH_STACK_SIZE (BVH_MAX_DEPTH + 1)
+#define WIDE_BVH_STACK_SIZE ((WIDE_BVH_WIDTH - 1) * BVH_MAX_DEPTH + 1)
+
+typedef struct {
+    uint32_t node;
+    float entry_distance;
+} traversal_entry;
+
+typedef struct {
+    uint32_t node;
+    uint32_t lanes; // Bit mask of packet lanes still interested in the node
+} packet_entry;
+
+// --- Private ---
+
+// Distance along the ray to the sphere, negative on a miss
+float intersect_sphere(const vec3s origin, const vec3s direction,
+                       const sphere *sph) {
+    vec4s sphere = {sph->center.x, sph->center.y, sph->center.z, sph->radius};
+    float t1, t2;
+    if (!glms_ray_sphere(origin, direction, sphere, &t1, &t2))
+        return -1;
+    return t1 > 0 ? t1 : t2;
+}
+
+// Distance along the ray to the triangle, negative on a miss
+float intersect_triangle(const vec3s origin, const vec3s direction,
+                         const triangle *tri) {
+    float dist;
+    if (!glms_ray_triangle(origin, direction, tri->v0, tri->v1, tri->v2,
+                           &dist))
+        return -1;
+    return dist;
+}
+
+ray_hit make_hit(const vec3s origin, const vec3s direction, float dist,
+                 const scene *world, uint32_t prim) {
+    uint32_t primitive = prim;
+    vec3s intersect = glms_vec3_add(glms_vec3_scale(direction, dist), origin);
+    vec3s normal;
+    material_index material;
+
+    if (prim < world->num_spheres) {
+        const sphere *sph = &world->spheres[prim];
+        normal = glms_vec3_normalize(glms_vec3_sub(intersect, sph->center));
+        material = world->sphere_materials[prim];
+    } else {
+        prim -= world->num_spheres;
+        const triangle *tri = &world->triangles[prim];
+        normal = glms_vec3_crossn(glms_vec3_sub(tri->v0, tri->v1),
+                                  glms_vec3_sub(tri->v0, tri->v2));
+
+        // Check if normal is facing the right way
+        if (glms_vec3_dot(normal, direction) > 0)
+            normal = glms_vec3_negate(normal);
+        material = world->triangle_materials[prim];
+    }
+
+    return (ray_hit){
+        .distance = dist,
+        .point = intersect,
+        .normal = normal,
+        .primitive = primitive,
+        .material = material,
+    };
+}
+
+void test_primitive(const vec3s origin, const vec3s direction,
+                    const scene *world, uint32_t prim, float *closest_dist,
+                    int *closest_prim) {
+    float dist;
+    if (prim < world->num_spheres)
+        dist = intersect_sphere(origin, direction, &world->spheres[prim]);
+    else
+        dist = intersect_triangle(origin, direction,
+                                  &world->triangles[prim - world->num_spheres]);
+
+    if (dist > 0 && dist < *closest_dist) {
+        *closest_dist = dist;
+        *closest_prim = prim;
+    }
+}
+
+void traverse_bvh(const scene *world, uint32_t root, const vec3s origin,
+                  const vec3s direction, float *closest_dist,
+                  int *closest_prim) {
+    const bvh *accel = &world->accel;
+    vec3s inv_direction = glms_vec3_div(glms_vec3_one(), direction);
+
+    float root_entry;
+    if (!bvh_intersect_node(&accel->nodes[root], origin, inv_direction,
+                            *closest_dist, &root_entry))
+        return;
+
+    traversal_entry stack[BVH_STACK_SIZE];
+    size_t stack_size = 0;
+    stack[stack_size++] = (traversal_entry){root, root_entry};
+
+    while (stack_size > 0) {
+        traversal_entry entry = stack[--stack_size];
+        if (entry.entry_distance > *closest_dist)
+            continue;
+
+        const bvh_node *node = &accel->nodes[entry.node];
+        if (node->count > 0) {
+            for (uint32_t i = 0; i < node->count; i++)
+                test_primitive(origin, direction, world,
+                               accel->indices[node->left_first + i],
+                               closest_dist, closest_prim);
+            continue;
+        }
+
+        // Visit the nearer child first
+        uint32_t near = node->left_first, far = node->left_first + 1;
+        float near_entry, far_entry;
+        bool near_hit =
+            bvh_intersect_node(&accel->nodes[near], origin, inv_direction,
+                               *closest_dist, &near_entry);
+        bool far_hit = bvh_intersect_node(&accel->nodes[far], origin,
+                                          inv_direction, *closest_dist,
+                                          &far_entry);
+        if (near_hit && far_hit && far_entry < near_entry) {
+            uint32_t tmp = near;
+            near = far;
+            far = tmp;
+            float tmp_entry = near_entry;
+            near_entry = far_entry;
+            far_entry = tmp_entry;
+            bool tmp_hit = near_hit;
+            near_hit = far_hit;
+            far_hit = tmp_hit;
+        }
+
+        if (far_hit)
+            stack[stack_size++] = (traversal_entry){far, far_entry};
+        if (near_hit)
+            stack[stack_size++] = (traversal_entry){near, near_entry};
+    }
+}
+
+void traverse_wide_bvh(const scene *world, const vec3s origin,
+                       const vec3s direction, float *closest_dist,
+                       int *closest_prim) {
+    const wide_bvh *accel = &world->compact_accel;
+    vec3s inv_direction = glms_vec3_div(glms_vec3_one(), direction);
+
+    traversal_entry stack[WIDE_BVH_STACK_SIZE];
+    size_t stack_size = 0;
+    stack[stack_size++] = (traversal_entry){0, 0};
+
+    while (stack_size > 0) {
+        traversal_entry entry = stack[--stack_size];
+        if (entry.entry_distance > *closest_dist)
+            continue;
+
+        const wide_bvh_node *node = &accel->nodes[entry.node];
+        float entry_distances[WIDE_BVH_WIDTH];
+        uint32_t mask = wide_bvh_intersect_node(
+            node, origin, inv_direction, *closest_dist, entry_distances);
+
+        // Test leaves right away, queue the other children farthest first
+        traversal_entry children[WIDE_BVH_WIDTH];
+        size_t num_children = 0;
+        for (size_t i = 0; i < node->num_children; i++) {
+            if (!(mask & 1u << i))
+                continue;
+
+            if (node->count[i] > 0) {
+                for (uint32_t j = 0; j < node->count[i]; j++)
+                    test_primitive(origin, direction, world,
+                                   accel->indices[node->child[i] + j],
+                                   closest_dist, closest_prim);
+                continue;
+            }
+
+            size_t k = num_children++;
+            float distance = entry_distances[i];
+            while (k > 0 && children[k - 1].entry_distance < distance) {
+                children[k] = children[k - 1];
+                k--;
+            }
+            children[k] = (traversal_entry){node->child[i], distance};
+        }
+
+        for (size_t i = 0; i < num_children; i++)
+            stack[stack_size++] = children[i];
+    }
+}
+
+int direction_octant(const vec3s direction) {
+    return (direction.x < 0) | (direction.y < 0) << 1 |
+           (direction.z < 0) << 2;
+}
+
+// --- Public ---
 
 ray_hit trace_ray(const vec3s origin, const vec3s direction,
                   const scene *world) {
-    float closest_dist = -1;
-    vec3s closest_point;
-    vec3s closest_normal;
-    size_t closest_material;
+    float closest_dist = INFINITY;
+    int closest_prim = -1;
 
     // Find closest intersection
-    for (int i = 0; i < world->num_objects; i++) {
-        shape obj = world->objects[i];
-
-        switch (obj.tag) {
-        case SPHERE: {
-            // Check whether ray intersects sphere
-            vec4s sphere = {obj.sphere.center.x, obj.sphere.center.y,
-                            obj.sphere.center.z, obj.sphere.radius};
-            float t1, t2;
-            if (!glms_ray_sphere(origin, direction, sphere, &t1, &t2))
-                break;
-
-            float dist = t1 > 0 ? t1 : t2;
-            if (dist >= closest_dist && closest_dist > 0)
-                break;
-
-            vec3s intersect =
-                glms_vec3_add(glms_vec3_scale(direction, dist), origin);
-            vec3s normal = glms_vec3_normalize(
-                glms_vec3_sub(intersect, obj.sphere.center));
-
-            closest_dist = dist;
-            closest_point = intersect;
-            closest_normal = normal;
-            closest_material = obj.material;
-            break;
+    if (world->accel.num_nodes > 0) {
+        traverse_bvh(world, 0, origin, direction, &closest_dist,
+                     &closest_prim);
+    } else if (world->compact_accel.num_nodes > 0) {
+        traverse_wide_bvh(world, origin, direction, &closest_dist,
+                          &closest_prim);
+    } else {
+        for (size_t i = 0; i < scene_num_primitives(world); i++)
+            test_primitive(origin, direction, world, i, &closest_dist,
+                           &closest_prim);
+    }
+
+    if (closest_prim < 0)
+        return (ray_hit){.distance = -1};
+    return make_hit(origin, direction, closest_dist, world, closest_prim);
+}
+
+void trace_packet(const ray_packet *packet, const scene *world,
+                  ray_hit *hits) {
+    size_t num_lanes = packet->num_lanes;
+
+    // Packets only pay off when all rays cross the nodes in the same order
+    bool coherent = world->accel.num_nodes > 0;
+    for (size_t i = 1; i < num_lanes && coherent; i++)
+        coherent = direction_octant(packet->directions[i]) ==
+                   direction_octant(packet->directions[0]);
+    if (!coherent) {
+        for (size_t i = 0; i < num_lanes; i++)
+            hits[i] = trace_ray(packet->origins[i], packet->directions[i],
+                                world);
+        return;
+    }
+
+    const bvh *accel = &world->accel;
+    float closest_dist[PACKET_MAX_LANES];
+    int closest_prim[PACKET_MAX_LANES];
+    vec3s inv_directions[PACKET_MAX_LANES];
+    for (size_t i = 0; i < num_lanes; i++) {
+        closest_dist[i] = INFINITY;
+        closest_prim[i] = -1;
+        inv_directions[i] =
+            glms_vec3_div(glms_vec3_one(), packet->directions[i]);
+    }
+
+    packet_entry stack[BVH_STACK_SIZE];
+    size_t stack_size = 0;
+    stack[stack_size++] = (packet_entry){0, (1u << num_lanes) - 1};
+
+    while (stack_size > 0) {
+        packet_entry entry = stack[--stack_size];
+        const bvh_node *node = &accel->nodes[entry.node];
+
+        // Shared node test, keeping only the lanes that hit it
+        uint32_t lanes = 0;
+        for (uint32_t mask = entry.lanes; mask != 0; mask &= mask - 1) {
+            int lane = __builtin_ctz(mask);
+            float entry_distance;
+            if (bvh_intersect_node(node, packet->origins[lane],
+                                   inv_directions[lane], closest_dist[lane],
+                                   &entry_distance))
+                lanes |= 1u << lane;
         }
-        case TRIANGLE: {
-            // Check whether ray intersects triangle
-            float dist;
-            if (!glms_ray_triangle(origin, direction, obj.triangle.v0,
-                                   obj.triangle.v1, obj.triangle.v2, &dist))
-                break;
-            if (dist >= closest_dist && closest_dist > 0)
-                break;
-
-            vec3s intersect =
-                glms_vec3_add(glms_vec3_scale(direction, dist), origin);
-            vec3s normal = glms_vec3_crossn(
-                glms_vec3_sub(obj.triangle.v0, obj.triangle.v1),
-                glms_vec3_sub(obj.triangle.v0, obj.triangle.v2));
-
-            // Check if normal is facing the right way
-            if (glms_vec3_dot(normal, direction) > 0)
-                normal = glms_vec3_negate(normal);
-
-            closest_dist = dist;
-            closest_point = intersect;
-            closest_normal = normal;
-            closest_material = obj.material;
-            break;
+        if (lanes == 0)
+            continue;
+
+        // Packet has diverged, finish this subtree with a single ray
+        if (__builtin_popcount(lanes) == 1) {
+            int lane = __builtin_ctz(lanes);
+            traverse_bvh(world, entry.node, packet->origins[lane],
+                         packet->directions[lane], &closest_dist[lane],
+                         &closest_prim[lane]);
+            continue;
+        }
+
+        if (node->count > 0) {
+            for (uint32_t i = 0; i < node->count; i++) {
+                uint32_t prim = accel->indices[node->left_first + i];
+                for (uint32_t mask = lanes; mask != 0; mask &= mask - 1) {
+                    int lane = __builtin_ctz(mask);
+                    test_primitive(packet->origins[lane],
+                                   packet->directions[lane], world, prim,
+                                   &closest_dist[lane], &closest_prim[lane]);
+                }
+            }
+            continue;
         }
+
+        // Order children by the first active lane, as all share an octant
+        int lane = __builtin_ctz(lanes);
+        uint32_t near = node->left_first, far = node->left_first + 1;
+        float near_entry, far_entry;
+        bvh_intersect_node(&accel->nodes[near], packet->origins[lane],
+                           inv_directions[lane], INFINITY, &near_entry);
+        bvh_intersect_node(&accel->nodes[far], packet->origins[lane],
+                           inv_directions[lane], INFINITY, &far_entry);
+        if (far_entry < near_entry) {
+            uint32_t tmp = near;
+            near = far;
+            far = tmp;
         }
+
+        stack[stack_size++] = (packet_entry){far, lanes};
+        stack[stack_size++] = (packet_entry){near, lanes};
     }
 
-    return (ray_hit){
-        .distance = closest_dist,
-        .point = closest_point,
-        .normal = closest_normal,
-        .material = closest_material,
-    };
+    for (size_t i = 0; i < num_lanes; i++) {
+        if (closest_prim[i] < 0)
+            hits[i] = (ray_hit){.distance = -1};
+        else
+            hits[i] = make_hit(packet->origins[i], packet->directions[i],
+                               closest_dist[i], world, closest_prim[i]);
+    }
 }
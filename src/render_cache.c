@@ -0,0 +1,110 @@
+#include "render_cache.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --- Private ---
+
+void render_cache_path(const render_cache *cache, uint64_t key, char *path,
+                       size_t size) {
+    snprintf(path, size, "%s/%016llx.ptfb", cache->directory,
+             (unsigned long long)key);
+}
+
+// --- Public ---
+
+int render_cache_init(render_cache *cache, const char *directory) {
+    if (strlen(directory) >= RENDER_CACHE_PATH_LENGTH) {
+        fprintf(stderr, "Cache directory path is too long: %s\n", directory);
+        return -1;
+    }
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create cache directory: %s\n", directory);
+        return -1;
+    }
+
+    strcpy(cache->directory, directory);
+    return 0;
+}
+
+int render_cache_load(const render_cache *cache, uint64_t key,
+                      framebuffer *fb) {
+    char path[RENDER_CACHE_PATH_LENGTH + 32];
+    render_cache_path(cache, key, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    // Read into scratch buffers so a bad entry leaves fb as it was
+    size_t num_pixels = fb->width * fb->height;
+    vec3s *color = malloc(num_pixels * sizeof(vec3s));
+    uint32_t *samples = malloc(num_pixels * sizeof(uint32_t));
+    render_cache_header header;
+    bool loaded =
+        fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, RENDER_CACHE_MAGIC,
+               sizeof(RENDER_CACHE_MAGIC)) == 0 &&
+        header.version == RENDER_CACHE_VERSION && header.key == key &&
+        header.width == fb->width && header.height == fb->height &&
+        fread(color, sizeof(vec3s), num_pixels, fp) == num_pixels &&
+        fread(samples, sizeof(uint32_t), num_pixels, fp) == num_pixels;
+    fclose(fp);
+
+    if (loaded) {
+        memcpy(fb->color, color, num_pixels * sizeof(vec3s));
+        memcpy(fb->samples, samples, num_pixels * sizeof(uint32_t));
+    } else {
+        fprintf(stderr, "Ignoring invalid cache entry: %s\n", path);
+    }
+    free(color);
+    free(samples);
+    return loaded ? 0 : -1;
+}
+
+int render_cache_store(const render_cache *cache, uint64_t key,
+                       const framebuffer *fb) {
+    // Written next to the entry and renamed over it once complete
+    char tmp_path[RENDER_CACHE_PATH_LENGTH + 32];
+    char path[RENDER_CACHE_PATH_LENGTH + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%016llx.XXXXXX",
+             cache->directory, (unsigned long long)key);
+    render_cache_path(cache, key, path, sizeof(path));
+
+    int fd = mkstemp(tmp_path);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to create cache entry in %s\n",
+                cache->directory);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return -1;
+    }
+
+    size_t num_pixels = fb->width * fb->height;
+    render_cache_header header = {
+        .version = RENDER_CACHE_VERSION,
+        .key = key,
+        .width = fb->width,
+        .height = fb->height,
+    };
+    memcpy(header.magic, RENDER_CACHE_MAGIC, sizeof(RENDER_CACHE_MAGIC));
+
+    bool written =
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(fb->color, sizeof(vec3s), num_pixels, fp) == num_pixels &&
+        fwrite(fb->samples, sizeof(uint32_t), num_pixels, fp) == num_pixels;
+    written = fclose(fp) == 0 && written;
+
+    if (!written || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write cache entry: %s\n", path);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
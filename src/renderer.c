@@ -1,116 +1,632 @@
 #include "renderer.h"
 #include "ray.h"
+#include "sampling.h"
+#include "scene_file.h"
+#include "wavefront.h"
 #include <cglm/struct.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <time.h>
 
-#define RANDOM_MAX 0x7FFFFFFF
 #define FOV M_PI / 180.f * 90.0f
-#define MAX_BOUNCES 4
-#define NUM_SAMPLES 16
+#define TILE_SIZE 32
+#define PACKET_SIZE 4
+
+// PCG32 per thread, random() takes a lock on every call
+_Thread_local uint64_t rand_state = 0x853c49e6748fea9bull;
+
+uint64_t rand_mix(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+void rand_seed(uint64_t seed, uint64_t stream, uint64_t sample) {
+    rand_state = rand_mix(seed ^ rand_mix(stream ^ rand_mix(sample)));
+}
+
+uint32_t rand_next() {
+    uint64_t old = rand_state;
+    rand_state = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << (-rot & 31));
+}
+
+float rand_float() { return (rand_next() >> 8) * 0x1p-24f; }
+
+uint64_t rand_save() { return rand_state; }
+
+void rand_restore(uint64_t state) { rand_state = state; }
 
 vec3s rand_unit_sphere() {
-    vec3s random_vector = {(double)random() / (double)RANDOM_MAX,
-                           (double)random() / (double)RANDOM_MAX,
-                           (double)random() / (double)RANDOM_MAX};
-    vec3s unit_range =
-        glms_vec3_sub(glms_vec3_scale(random_vector, 2), glms_vec3_one());
-    vec3s unit_sphere = glms_vec3_normalize(unit_range);
-    return unit_sphere;
+    float u1 = rand_float();
+    return sampling_unit_sphere_one(u1, rand_float());
 }
 
-vec3s incident_light(vec3s origin, vec3s direction, const scene *world,
-                     size_t bounces) {
-    // Recursion base case
-    if (bounces > MAX_BOUNCES)
-        return world->sky_color;
-    bounces++;
+// Orthonormal basis around a unit vector
+void make_basis(const vec3s n, vec3s *tangent, vec3s *bitangent) {
+    vec3s helper = fabsf(n.x) > 0.9f ? (vec3s){0, 1, 0} : (vec3s){1, 0, 0};
+    *tangent = glms_vec3_normalize(glms_vec3_cross(helper, n));
+    *bitangent = glms_vec3_cross(n, *tangent);
+}
 
-    ray_hit hit = trace_ray(origin, direction, world);
+// Pick a point on an emitter with the light tree and trace a shadow ray to
+// it. Returns incident radiance times cosine over pdf for a diffuse lobe.
+vec3s sample_direct_light(const ray_hit *hit, const scene *world) {
+    uint32_t prim;
+    float pmf;
+    if (!light_tree_sample(&world->lights, hit->point, hit->normal,
+                           rand_float(), &prim, &pmf))
+        return glms_vec3_zero();
 
-    // Ray didn't hit anything
-    if (hit.distance < 0)
-        return world->sky_color;
+    vec3s light_direction;
+    float pdf; // Solid angle density of light_direction
+    if (prim < world->num_spheres) {
+        // Sample the cone of directions subtended by the sphere
+        const sphere *sph = &world->spheres[prim];
+        vec3s to_center = glms_vec3_sub(sph->center, hit->point);
+        float dist2 = glms_vec3_norm2(to_center);
+        if (dist2 <= sph->radius * sph->radius)
+            return glms_vec3_zero();
+
+        float sin2_max = sph->radius * sph->radius / dist2;
+        float one_minus_cos_max = sin2_max / (1 + sqrtf(1 - sin2_max));
+        float cos_theta = 1 - rand_float() * one_minus_cos_max;
+        float sin_theta = sqrtf(fmaxf(0, 1 - cos_theta * cos_theta));
+        float sin_phi, cos_phi;
+        sampling_sincos_turns(rand_float(), &sin_phi, &cos_phi);
+
+        vec3s axis = glms_vec3_scale(to_center, 1 / sqrtf(dist2));
+        vec3s tangent, bitangent;
+        make_basis(axis, &tangent, &bitangent);
+        light_direction = glms_vec3_add(
+            glms_vec3_scale(axis, cos_theta),
+            glms_vec3_add(glms_vec3_scale(tangent, sin_theta * cos_phi),
+                          glms_vec3_scale(bitangent, sin_theta * sin_phi)));
+        pdf = 1 / (2 * M_PI * one_minus_cos_max);
+    } else {
+        // Sample the triangle uniformly by area
+        const triangle *tri = &world->triangles[prim - world->num_spheres];
+        float u = rand_float(), v = rand_float();
+        if (u + v > 1) {
+            u = 1 - u;
+            v = 1 - v;
+        }
+        vec3s e1 = glms_vec3_sub(tri->v1, tri->v0);
+        vec3s e2 = glms_vec3_sub(tri->v2, tri->v0);
+        vec3s point = glms_vec3_add(
+            tri->v0,
+            glms_vec3_add(glms_vec3_scale(e1, u), glms_vec3_scale(e2, v)));
+
+        vec3s cross = glms_vec3_cross(e1, e2);
+        float area = 0.5f * glms_vec3_norm(cross);
+        vec3s to_light = glms_vec3_sub(point, hit->point);
+        float dist2 = glms_vec3_norm2(to_light);
+        light_direction = glms_vec3_scale(to_light, 1 / sqrtf(dist2));
 
-    shape_material mat = world->materials[hit.material];
+        float cos_light = fabsf(glms_vec3_dot(glms_vec3_normalize(cross),
+                                              light_direction));
+        if (cos_light <= 0 || area <= 0)
+            return glms_vec3_zero();
+        pdf = dist2 / (cos_light * area);
+    }
+
+    float cos_surface = glms_vec3_dot(hit->normal, light_direction);
+    if (cos_surface <= 0)
+        return glms_vec3_zero();
+
+    // Shadow ray, the light is visible if it is what the ray hits first
+    vec3s shadow_origin =
+        glms_vec3_add(hit->point, glms_vec3_scale(light_direction, 0.001));
+    ray_hit shadow = trace_ray(shadow_origin, light_direction, world);
+    if (shadow.distance < 0 || shadow.primitive != prim)
+        return glms_vec3_zero();
+
+    vec3s Le = world->hot_materials[shadow.material].emission;
+    return glms_vec3_scale(Le, cos_surface / (M_PI * pdf * pmf));
+}
 
-    // Surface emission
-    vec3s Le = glms_vec3_scale(mat.emission_color, mat.emission_strength);
+size_t scatter_rays(const vec3s direction, const ray_hit *hit,
+                    const hot_material *mat, scattered_ray *out) {
+    size_t count = 0;
 
     // Normal based on roughness
-    vec3s deviation = glms_vec3_scale(rand_unit_sphere(), mat.roughness * 0.5);
-    vec3s normal = glms_vec3_normalize(glms_vec3_add(hit.normal, deviation));
+    vec3s deviation = glms_vec3_scale(rand_unit_sphere(), mat->roughness * 0.5);
+    vec3s normal = glms_vec3_normalize(glms_vec3_add(hit->normal, deviation));
 
-    // Calculate reflected incident light
-    vec3s reflected_Li = glms_vec3_zero();
-    if (mat.transparency < 1.0) {
+    // Reflected ray, fully rough surfaces scatter with a cosine lobe
+    if (mat->transparency < 1.0) {
         vec3s reflect_direction =
-            glms_vec3_normalize(glms_vec3_reflect(direction, normal));
-        vec3s reflect_origin =
-            glms_vec3_add(hit.point, glms_vec3_scale(reflect_direction, 0.001));
-        reflected_Li =
-            incident_light(reflect_origin, reflect_direction, world, bounces);
+            mat->roughness >= DIFFUSE_ROUGHNESS
+                ? glms_vec3_add(hit->normal, rand_unit_sphere())
+                : glms_vec3_reflect(direction, normal);
+        reflect_direction = glms_vec3_normalize(reflect_direction);
+        out[count++] = (scattered_ray){
+            .origin = glms_vec3_add(hit->point,
+                                    glms_vec3_scale(reflect_direction, 0.001)),
+            .direction = reflect_direction,
+            .weight = 1.0 - mat->transparency,
+            .reflected = true,
+        };
     }
 
-    // Calculate transmitted incident light
-    vec3s transmitted_Li = glms_vec3_zero();
-    if (mat.transparency > 0.0) {
+    // Transmitted ray
+    if (mat->transparency > 0.0) {
         float dot = glms_vec3_dot(direction, normal);
         float refractive_index = dot < 0 ? 1.5 : 1 / 1.5;
         vec3s refraction_normal = dot < 0 ? normal : glms_vec3_negate(normal);
 
-        vec3s transmit_origin, transmit_direction;
+        vec3s transmit_direction;
         if (glms_vec3_refract(direction, refraction_normal,
                               1.0 / refractive_index, &transmit_direction)) {
             transmit_direction = glms_vec3_normalize(transmit_direction);
-            transmit_origin = glms_vec3_add(
-                hit.point, glms_vec3_scale(transmit_direction, 0.001));
-            transmitted_Li = incident_light(transmit_origin, transmit_direction,
-                                            world, bounces);
+            out[count++] = (scattered_ray){
+                .origin = glms_vec3_add(
+                    hit->point, glms_vec3_scale(transmit_direction, 0.001)),
+                .direction = transmit_direction,
+                .weight = mat->transparency,
+                .reflected = false,
+            };
+        }
+    }
+
+    return count;
+}
+
+vec3s shade_hit(const vec3s direction, const ray_hit *hit, const scene *world,
+                guiding *guide, size_t bounces, bool count_emission) {
+    const hot_material *mat = &world->hot_materials[hit->material];
+
+    // Surface emission, skipped when the previous hit sampled it directly
+    vec3s Le = count_emission ? mat->emission : glms_vec3_zero();
+
+    // Diffuse surfaces gather direct light from the light tree, so their
+    // reflected rays must not count emitters again
+    bool diffuse = mat->roughness >= DIFFUSE_ROUGHNESS;
+    bool sample_lights = world->lights.num_nodes > 0 && diffuse &&
+                         mat->transparency < 1.0;
+    vec3s Li = glms_vec3_zero();
+    if (sample_lights)
+        Li = glms_vec3_scale(sample_direct_light(hit, world),
+                             1.0 - mat->transparency);
+
+    // Calculate reflected and transmitted incident light
+    scattered_ray scattered[2];
+    size_t num_scattered = scatter_rays(direction, hit, mat, scattered);
+
+    for (size_t i = 0; i < num_scattered; i++) {
+        bool guided_bounce =
+            guide != NULL && diffuse && scattered[i].reflected;
+
+        // Once fitted, the guide picks diffuse bounces instead
+        float guide_weight = 1;
+        if (guided_bounce && guide->ready) {
+            guide_weight = guiding_sample(guide, hit->point, hit->normal,
+                                          rand_float(), rand_float(),
+                                          rand_float(),
+                                          &scattered[i].direction);
+            if (guide_weight == 0)
+                continue;
+            scattered[i].origin = glms_vec3_add(
+                hit->point, glms_vec3_scale(scattered[i].direction, 0.001));
+            scattered[i].weight *= guide_weight;
         }
+
+        bool child_emission = !(sample_lights && scattered[i].reflected);
+        vec3s child =
+            incident_light(scattered[i].origin, scattered[i].direction, world,
+                           guide, bounces, child_emission);
+        Li = glms_vec3_add(Li, glms_vec3_scale(child, scattered[i].weight));
+
+        if (guided_bounce)
+            guiding_record(guide, hit->point, scattered[i].direction,
+                           glms_vec3_scale(child, guide_weight));
     }
 
-    vec3s Li = glms_vec3_lerp(reflected_Li, transmitted_Li, mat.transparency);
-    return glms_vec3_add(Le, glms_vec3_mul(Li, mat.albedo));
+    return glms_vec3_add(Le, glms_vec3_mul(Li, mat->albedo));
+}
+
+vec3s incident_light(vec3s origin, vec3s direction, const scene *world,
+                     guiding *guide, size_t bounces, bool count_emission) {
+    // Recursion base case
+    if (bounces > MAX_BOUNCES)
+        return world->sky_color;
+    bounces++;
+
+    ray_hit hit = trace_ray(origin, direction, world);
+
+    // Ray didn't hit anything
+    if (hit.distance < 0)
+        return world->sky_color;
+
+    return shade_hit(direction, &hit, world, guide, bounces, count_emission);
+}
+
+camera camera_default() {
+    return (camera){.position = glms_vec3_zero(), .fov = FOV};
 }
 
-vec3s per_pixel(const float x, const float y, const float aspect_ratio,
-                const scene *world) {
-    const float tangent_fov_2 = tanf(FOV / 2.0f);
+vec3s primary_direction(const camera *cam, const float x, const float y,
+                        const float aspect_ratio) {
+    const float tangent_fov_2 = tanf(cam->fov / 2.0f);
 
-    vec3s origin = {0, 0, 0};
-    vec3s direction = glms_vec3_normalize((vec3s){
+    return glms_vec3_normalize((vec3s){
         x * tangent_fov_2,
         y * tangent_fov_2 / aspect_ratio,
         1,
     });
+}
+
+vec3s per_pixel(const camera *cam, const float x, const float y,
+                const float aspect_ratio, const scene *world, guiding *guide) {
+    vec3s direction = primary_direction(cam, x, y, aspect_ratio);
+
+    return incident_light(cam->position, direction, world, guide, 0, true);
+}
+
+typedef struct {
+    uint64_t end_ns;
+    atomic_bool expired;
+} render_deadline;
 
-    vec3s result = incident_light(origin, direction, world, 0);
-    result = glms_vec3_clamp(result, 0, 1);
-    return result;
+typedef struct {
+    const scene *world;
+    const camera *cam;
+    framebuffer *fb;
+    size_t x0, y0, x1, y1;
+    size_t preview_scale;
+    bool wavefront;
+    bool packets;
+    gbuffer *gbuffer;
+    guiding *guide;
+    uint64_t seed;
+    render_deadline *deadline;
+} tile_args;
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-void render_task(render_args *args) {
-    render_args copied_args = *args;
-    float aspect_ratio = (float)copied_args.framew / (float)copied_args.frameh;
+bool deadline_passed(render_deadline *deadline) {
+    // Only touch the clock until the first worker notices expiry
+    if (atomic_load_explicit(&deadline->expired, memory_order_relaxed))
+        return true;
+    if (monotonic_ns() < deadline->end_ns)
+        return false;
 
-    for (int screen_x = 0; screen_x < copied_args.framew; screen_x++) {
-        // Calculate screen-space coordinates
-        float x = ((float)screen_x / copied_args.framew * 2.0f - 1.0f);
-        float y =
-            -((float)copied_args.screen_y / copied_args.frameh * 2.0f - 1.0f);
+    atomic_store_explicit(&deadline->expired, true, memory_order_relaxed);
+    return true;
+}
 
-        // Calculate pixel color
-        vec3s result = glms_vec3_zero();
-        for (int j = 0; j < NUM_SAMPLES; j++) {
-            vec3s sample = per_pixel(x, y, aspect_ratio, copied_args.world);
-            result = glms_vec3_add(result, sample);
+void preview_tile_task(tile_args *args) {
+    framebuffer *fb = args->fb;
+    size_t scale = args->preview_scale;
+    float aspect_ratio = (float)fb->width / (float)fb->height;
+
+    // One sample per block, splatted over the whole block
+    for (size_t by = args->y0; by < args->y1; by += scale) {
+        for (size_t bx = args->x0; bx < args->x1; bx += scale) {
+            float x = ((float)bx / fb->width * 2.0f - 1.0f);
+            float y = -((float)by / fb->height * 2.0f - 1.0f);
+            rand_seed(args->seed, by * fb->width + bx, UINT64_MAX - scale);
+            vec3s sample =
+                per_pixel(args->cam, x, y, aspect_ratio, args->world,
+                          args->guide);
+
+            for (size_t py = by; py < by + scale && py < args->y1; py++)
+                for (size_t px = bx; px < bx + scale && px < args->x1; px++)
+                    fb->preview[py * fb->width + px] = sample;
+        }
+    }
+}
+
+// Trace camera rays of PACKET_SIZE x PACKET_SIZE blocks as one packet
+void packet_tile_task(tile_args *args) {
+    framebuffer *fb = args->fb;
+    float aspect_ratio = (float)fb->width / (float)fb->height;
+
+    for (size_t by = args->y0; by < args->y1; by += PACKET_SIZE) {
+        if (deadline_passed(args->deadline))
+            return;
+
+        for (size_t bx = args->x0; bx < args->x1; bx += PACKET_SIZE) {
+            ray_packet packet = {.num_lanes = 0};
+            size_t lane_x[PACKET_MAX_LANES], lane_y[PACKET_MAX_LANES];
+
+            for (size_t py = by; py < by + PACKET_SIZE && py < args->y1; py++) {
+                float y = -((float)py / fb->height * 2.0f - 1.0f);
+                for (size_t px = bx; px < bx + PACKET_SIZE && px < args->x1;
+                     px++) {
+                    float x = ((float)px / fb->width * 2.0f - 1.0f);
+                    size_t lane = packet.num_lanes++;
+                    packet.origins[lane] = args->cam->position;
+                    packet.directions[lane] =
+                        primary_direction(args->cam, x, y, aspect_ratio);
+                    lane_x[lane] = px;
+                    lane_y[lane] = py;
+                }
+            }
+
+            ray_hit hits[PACKET_MAX_LANES];
+            trace_packet(&packet, args->world, hits);
+
+            // Continue each path on its own after the first hit
+            for (size_t lane = 0; lane < packet.num_lanes; lane++) {
+                size_t idx = lane_y[lane] * fb->width + lane_x[lane];
+                rand_seed(args->seed, idx, fb->samples[idx]);
+                vec3s result = args->world->sky_color;
+                if (hits[lane].distance >= 0)
+                    result = shade_hit(packet.directions[lane], &hits[lane],
+                                       args->world, args->guide, 1, true);
+                framebuffer_add_sample(fb, lane_x[lane], lane_y[lane],
+                                       result);
+            }
+        }
+    }
+}
+
+// Shade camera rays from cached first hits, capturing any that are missing
+void gbuffer_tile_task(tile_args *args) {
+    framebuffer *fb = args->fb;
+    float aspect_ratio = (float)fb->width / (float)fb->height;
+
+    for (size_t screen_y = args->y0; screen_y < args->y1; screen_y++) {
+        if (deadline_passed(args->deadline))
+            return;
+
+        float y = -((float)screen_y / fb->height * 2.0f - 1.0f);
+        for (size_t screen_x = args->x0; screen_x < args->x1; screen_x++) {
+            float x = ((float)screen_x / fb->width * 2.0f - 1.0f);
+            vec3s direction = primary_direction(args->cam, x, y, aspect_ratio);
+
+            size_t idx = screen_y * fb->width + screen_x;
+            gbuffer_texel *texel = &args->gbuffer->texels[idx];
+            if (texel->state == GBUFFER_EMPTY) {
+                ray_hit hit =
+                    trace_ray(args->cam->position, direction, args->world);
+                gbuffer_store(texel, &hit);
+            }
+
+            rand_seed(args->seed, idx, fb->samples[idx]);
+            vec3s sample = args->world->sky_color;
+            if (texel->state == GBUFFER_HIT) {
+                ray_hit hit = gbuffer_hit(texel, args->cam, direction);
+                sample = shade_hit(direction, &hit, args->world, args->guide,
+                                   1, true);
+            }
+            framebuffer_add_sample(fb, screen_x, screen_y, sample);
         }
-        result = glms_vec3_scale(result, 1.0f / NUM_SAMPLES * 255.0f);
+    }
+}
+
+void progressive_tile_task(tile_args *args) {
+    framebuffer *fb = args->fb;
+
+    // Cached hits make primary visibility free, so they take precedence
+    if (args->gbuffer != NULL) {
+        gbuffer_tile_task(args);
+        return;
+    }
 
-        // Write to frame buffer
-        int idx = copied_args.screen_y * copied_args.framew + screen_x;
-        copied_args.frame[3 * idx + 0] = result.r;
-        copied_args.frame[3 * idx + 1] = result.g;
-        copied_args.frame[3 * idx + 2] = result.b;
+    // Wavefront tiles can only be abandoned before their paths start
+    if (args->wavefront) {
+        if (deadline_passed(args->deadline))
+            return;
+
+        // Tiles run whole or not at all
+        wavefront_render_tile(args->world, args->cam, fb, args->guide,
+                              args->seed, args->x0, args->y0, args->x1,
+                              args->y1);
+        return;
+    }
+    if (args->packets) {
+        packet_tile_task(args);
+        return;
+    }
+
+    float aspect_ratio = (float)fb->width / (float)fb->height;
+
+    for (size_t screen_y = args->y0; screen_y < args->y1; screen_y++) {
+        // Stop cooperatively, leaving every finished pixel accounted for
+        if (deadline_passed(args->deadline))
+            return;
+
+        float y = -((float)screen_y / fb->height * 2.0f - 1.0f);
+        for (size_t screen_x = args->x0; screen_x < args->x1; screen_x++) {
+            float x = ((float)screen_x / fb->width * 2.0f - 1.0f);
+
+            // Seeded by pixel and sample, so accumulations are repeatable
+            // and can be resumed
+            size_t idx = screen_y * fb->width + screen_x;
+            rand_seed(args->seed, idx, fb->samples[idx]);
+            vec3s sample =
+                per_pixel(args->cam, x, y, aspect_ratio, args->world,
+                          args->guide);
+            framebuffer_add_sample(fb, screen_x, screen_y, sample);
+        }
     }
 }
+
+// Cache key over everything the image depends on except its sample count
+uint64_t render_cache_key(const scene *world, const camera *cam,
+                          const framebuffer *fb,
+                          const progressive_settings *settings) {
+    uint64_t hash = scene_content_hash(world);
+    hash = scene_hash_bytes(hash, &cam->position, sizeof(vec3s));
+    hash = scene_hash_bytes(hash, &cam->fov, sizeof(float));
+    hash = scene_hash_bytes(hash, &fb->width, sizeof(size_t));
+    hash = scene_hash_bytes(hash, &fb->height, sizeof(size_t));
+    hash = scene_hash_bytes(hash, &settings->seed, sizeof(uint64_t));
+
+    // Light tree sampling changes the estimator, not just the noise
+    uint8_t light_sampling = world->lights.num_nodes > 0;
+    hash = scene_hash_bytes(hash, &light_sampling, sizeof(light_sampling));
+
+    // Each path changes which random numbers go where, in the order
+    // progressive_tile_task picks them
+    uint8_t path = 0;
+    if (settings->gbuffer != NULL)
+        path = 1;
+    else if (settings->wavefront)
+        path = 2;
+    else if (settings->packets)
+        path = 3;
+    return scene_hash_bytes(hash, &path, sizeof(path));
+}
+
+// Runs one task per tile on the group's pool, or inline without a pool
+void run_tiles(task_group *group, void (*task)(tile_args *), tile_args *tiles,
+               size_t num_tiles) {
+    if (group->pool == NULL) {
+        for (size_t i = 0; i < num_tiles; i++)
+            task(&tiles[i]);
+        return;
+    }
+
+    for (size_t i = 0; i < num_tiles; i++)
+        task_group_add(group, (void (*)(void *))task, &tiles[i]);
+    task_group_wait(group);
+}
+
+progressive_result render_progressive(threadpool *pool, scene *world,
+                                      const camera *cam, framebuffer *fb,
+                                      const progressive_settings *settings) {
+    uint64_t start_ns = monotonic_ns();
+    render_deadline deadline = {
+        .end_ns = settings->budget_ms > 0
+                      ? start_ns + (uint64_t)(settings->budget_ms * 1e6)
+                      : UINT64_MAX,
+    };
+    atomic_init(&deadline.expired, false);
+
+    framebuffer_region region = settings->region;
+    if (region.x1 == 0 || region.x1 > fb->width)
+        region.x1 = fb->width;
+    if (region.y1 == 0 || region.y1 > fb->height)
+        region.y1 = fb->height;
+    if (region.x0 > region.x1)
+        region.x0 = region.x1;
+    if (region.y0 > region.y1)
+        region.y0 = region.y1;
+    bool full_frame = region.x0 == 0 && region.y0 == 0 &&
+                      region.x1 == fb->width && region.y1 == fb->height;
+    if (region.x0 == region.x1 || region.y0 == region.y1)
+        return (progressive_result){0};
+
+    // Guided paths depend on what the guide learned before, so they are
+    // never cached. Entries hold whole frames, loading one for a crop would
+    // overwrite the pixels around it, and loading one over samples from an
+    // earlier call would throw those away.
+    uint64_t cache_key = 0;
+    uint32_t cached_samples = 0;
+    uint32_t prior_samples = framebuffer_region_min_samples(fb, &region);
+    bool caching = settings->cache != NULL && settings->guiding == NULL &&
+                   full_frame;
+    if (caching) {
+        cache_key = render_cache_key(world, cam, fb, settings);
+        if (prior_samples == 0 &&
+            render_cache_load(settings->cache, cache_key, fb) == 0) {
+            cached_samples = framebuffer_min_samples(fb);
+            prior_samples = cached_samples;
+        }
+    }
+    if (settings->max_samples > 0 && prior_samples >= settings->max_samples)
+        return (progressive_result){
+            .samples_per_pixel = prior_samples,
+            .passes = 0,
+            .elapsed_ms = (monotonic_ns() - start_ns) / 1e6,
+            .deadline_hit = false,
+            .cached_samples = cached_samples,
+        };
+
+    if (settings->gbuffer != NULL)
+        gbuffer_prepare(settings->gbuffer, world, cam, fb->width, fb->height);
+    if (settings->guiding != NULL)
+        guiding_prepare(settings->guiding, world);
+
+    // Split the region into tiles
+    size_t tiles_x = (region.x1 - region.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    size_t tiles_y = (region.y1 - region.y0 + TILE_SIZE - 1) / TILE_SIZE;
+    size_t num_tiles = tiles_x * tiles_y;
+    tile_args *tiles = malloc(num_tiles * sizeof(tile_args));
+
+    for (size_t ty = 0; ty < tiles_y; ty++) {
+        for (size_t tx = 0; tx < tiles_x; tx++) {
+            tile_args *tile = &tiles[ty * tiles_x + tx];
+            *tile = (tile_args){
+                .world = world,
+                .cam = cam,
+                .fb = fb,
+                .x0 = region.x0 + tx * TILE_SIZE,
+                .y0 = region.y0 + ty * TILE_SIZE,
+                .x1 = region.x0 + tx * TILE_SIZE + TILE_SIZE,
+                .y1 = region.y0 + ty * TILE_SIZE + TILE_SIZE,
+                .wavefront = settings->wavefront,
+                .packets = settings->packets,
+                .gbuffer = settings->gbuffer,
+                .guide = settings->guiding,
+                .seed = settings->seed,
+                .deadline = &deadline,
+            };
+            if (tile->x1 > region.x1)
+                tile->x1 = region.x1;
+            if (tile->y1 > region.y1)
+                tile->y1 = region.y1;
+        }
+    }
+
+    // Only wait on our own tiles so other jobs can share the pool
+    task_group group;
+    task_group_init(&group, pool);
+
+    // Coarse to fine preview levels, each halving the block size down to 2.
+    // The first ignores the deadline so there is always an image. Regions
+    // that already have samples skip them.
+    for (size_t scale = settings->preview_scale;
+         scale > 0 && prior_samples == 0; scale /= 2) {
+        if (scale < settings->preview_scale &&
+            (scale < 2 || deadline_passed(&deadline)))
+            break;
+
+        for (size_t i = 0; i < num_tiles; i++)
+            tiles[i].preview_scale = scale;
+        run_tiles(&group, preview_tile_task, tiles, num_tiles);
+    }
+
+    // Full resolution passes until the budget runs out
+    size_t passes = 0;
+    while (!deadline_passed(&deadline)) {
+        if (settings->max_samples > 0 &&
+            prior_samples + passes >= settings->max_samples)
+            break;
+
+        run_tiles(&group, progressive_tile_task, tiles, num_tiles);
+        passes++;
+
+        if (settings->guiding != NULL)
+            guiding_end_pass(settings->guiding);
+
+        // Mapped scenes give pages back once over their resident budget
+        scene_file_trim(world);
+    }
+
+    free(tiles);
+
+    // Unsampled pixels would come back black, as they have no preview
+    uint32_t samples_per_pixel = framebuffer_region_min_samples(fb, &region);
+    if (caching && passes > 0 && samples_per_pixel > 0)
+        render_cache_store(settings->cache, cache_key, fb);
+
+    return (progressive_result){
+        .samples_per_pixel = samples_per_pixel,
+        .passes = passes,
+        .elapsed_ms = (monotonic_ns() - start_ns) / 1e6,
+        .deadline_hit = atomic_load(&deadline.expired),
+        .cached_samples = cached_samples,
+    };
+}
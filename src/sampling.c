@@ -0,0 +1,310 @@
+#include "sampling.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SAMPLING_TWO_PI 6.28318530717958647692f
+#define SAMPLING_SQRT_HALF 0.70710678118654752440f
+
+// Minimax polynomials on [-pi/4, pi/4] and the log mantissa range, as used
+// by the Cephes sinf, cosf and logf
+#define SAMPLING_SIN_1 -1.6666654611e-1f
+#define SAMPLING_SIN_2 8.3321608736e-3f
+#define SAMPLING_SIN_3 -1.9515295891e-4f
+#define SAMPLING_COS_1 4.166664568298827e-2f
+#define SAMPLING_COS_2 -1.388731625493765e-3f
+#define SAMPLING_COS_3 2.443315711809948e-5f
+#define SAMPLING_LOG_LO -2.12194440e-4f // ln 2 split in two parts
+#define SAMPLING_LOG_HI 0.693359375f
+
+const float sampling_log_poly[9] = {
+    7.0376836292e-2f,  -1.1514610310e-1f, 1.1676998740e-1f,
+    -1.2420140846e-1f, 1.4249322787e-1f,  -1.6668057665e-1f,
+    2.0000714765e-1f,  -2.4999993993e-1f, 3.3333331174e-1f,
+};
+
+// --- Private ---
+
+#ifdef __SSE2__
+__m128 sampling_floor4(__m128 x) {
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    __m128 too_big = _mm_cmpgt_ps(truncated, x);
+    return _mm_sub_ps(truncated, _mm_and_ps(too_big, _mm_set1_ps(1)));
+}
+
+void sampling_sincos4(__m128 turns, __m128 *sin_out, __m128 *cos_out) {
+    // Nearest quarter turn, leaving an angle in [-pi/4, pi/4]
+    __m128 t = _mm_sub_ps(turns, sampling_floor4(turns));
+    __m128i quadrant = _mm_cvttps_epi32(
+        _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(4)), _mm_set1_ps(0.5f)));
+    __m128 r = _mm_mul_ps(
+        _mm_sub_ps(t, _mm_mul_ps(_mm_cvtepi32_ps(quadrant),
+                                 _mm_set1_ps(0.25f))),
+        _mm_set1_ps(SAMPLING_TWO_PI));
+    __m128 z = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_set1_ps(SAMPLING_SIN_2),
+                          _mm_mul_ps(z, _mm_set1_ps(SAMPLING_SIN_3)));
+    s = _mm_add_ps(_mm_set1_ps(SAMPLING_SIN_1), _mm_mul_ps(z, s));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, z), s));
+
+    __m128 c = _mm_add_ps(_mm_set1_ps(SAMPLING_COS_2),
+                          _mm_mul_ps(z, _mm_set1_ps(SAMPLING_COS_3)));
+    c = _mm_add_ps(_mm_set1_ps(SAMPLING_COS_1), _mm_mul_ps(z, c));
+    c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(_mm_set1_ps(0.5f), z)),
+                   _mm_mul_ps(_mm_mul_ps(z, z), c));
+
+    // Odd quadrants swap sine and cosine, the sign bits follow the quadrant
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sin_sign = _mm_castsi128_ps(
+        _mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)),
+                      _mm_set1_epi32(2)),
+        30));
+    *sin_out = _mm_xor_ps(
+        _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sin_sign);
+    *cos_out = _mm_xor_ps(
+        _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cos_sign);
+}
+
+__m128 sampling_log4(__m128 x) {
+    // x = m 2^e with m in [sqrt(1/2), sqrt(2))
+    __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(
+        _mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)),
+        _mm_set1_epi32(126)));
+    __m128 m = _mm_castsi128_ps(
+        _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807fffff)),
+                     _mm_set1_epi32(0x3f000000)));
+    __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(SAMPLING_SQRT_HALF));
+    e = _mm_sub_ps(e, _mm_and_ps(small, _mm_set1_ps(1)));
+    m = _mm_sub_ps(_mm_add_ps(m, _mm_and_ps(small, m)), _mm_set1_ps(1));
+
+    __m128 z = _mm_mul_ps(m, m);
+    __m128 y = _mm_set1_ps(sampling_log_poly[0]);
+    for (size_t i = 1; i < 9; i++)
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(sampling_log_poly[i]));
+    y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(SAMPLING_LOG_LO)));
+    y = _mm_sub_ps(y, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+    return _mm_add_ps(_mm_add_ps(m, y),
+                      _mm_mul_ps(e, _mm_set1_ps(SAMPLING_LOG_HI)));
+}
+
+// Hardware estimate refined by one Newton step
+__m128 sampling_rsqrt4(__m128 x) {
+    __m128 y = _mm_rsqrt_ps(x);
+    __m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y),
+                      _mm_sub_ps(_mm_set1_ps(3), yyx));
+}
+#endif
+
+// --- Public ---
+
+void sampling_sincos_turns(float turns, float *sin_out, float *cos_out) {
+    float t = turns - floorf(turns);
+    int quadrant = (int)(t * 4 + 0.5f);
+    float r = (t - quadrant * 0.25f) * SAMPLING_TWO_PI;
+    float z = r * r;
+
+    float s = r + r * z *
+                      (SAMPLING_SIN_1 +
+                       z * (SAMPLING_SIN_2 + z * SAMPLING_SIN_3));
+    float c = 1 - 0.5f * z +
+              z * z *
+                  (SAMPLING_COS_1 + z * (SAMPLING_COS_2 + z * SAMPLING_COS_3));
+
+    switch (quadrant & 3) {
+    case 0:
+        *sin_out = s;
+        *cos_out = c;
+        break;
+    case 1:
+        *sin_out = c;
+        *cos_out = -s;
+        break;
+    case 2:
+        *sin_out = -s;
+        *cos_out = -c;
+        break;
+    default:
+        *sin_out = -c;
+        *cos_out = s;
+        break;
+    }
+}
+
+float sampling_log(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = (int)((bits >> 23) & 0xff) - 126;
+    bits = (bits & 0x807fffff) | 0x3f000000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m < SAMPLING_SQRT_HALF) {
+        e--;
+        m = m + m - 1;
+    } else {
+        m = m - 1;
+    }
+
+    float z = m * m;
+    float y = sampling_log_poly[0];
+    for (size_t i = 1; i < 9; i++)
+        y = y * m + sampling_log_poly[i];
+    y = y * m * z;
+    y += e * SAMPLING_LOG_LO;
+    y -= 0.5f * z;
+    return m + y + e * SAMPLING_LOG_HI;
+}
+
+float sampling_rsqrt(float x) { return 1 / sqrtf(x); }
+
+vec3s sampling_unit_sphere_one(float u1, float u2) {
+    float z = 1 - 2 * u1;
+    float r = sqrtf(fmaxf(0, 1 - z * z));
+    float s, c;
+    sampling_sincos_turns(u2, &s, &c);
+    return (vec3s){r * c, r * s, z};
+}
+
+vec3s sampling_cosine_hemisphere_one(float u1, float u2) {
+    float r = sqrtf(u1);
+    float s, c;
+    sampling_sincos_turns(u2, &s, &c);
+    return (vec3s){r * c, r * s, sqrtf(fmaxf(0, 1 - u1))};
+}
+
+void sampling_unit_sphere(const float *u1, const float *u2, size_t count,
+                          float *x, float *y, float *z) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 zs = _mm_sub_ps(
+            _mm_set1_ps(1), _mm_mul_ps(_mm_set1_ps(2), _mm_loadu_ps(&u1[i])));
+        __m128 r = _mm_sqrt_ps(_mm_max_ps(
+            _mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(zs, zs))));
+        __m128 s, c;
+        sampling_sincos4(_mm_loadu_ps(&u2[i]), &s, &c);
+        _mm_storeu_ps(&x[i], _mm_mul_ps(r, c));
+        _mm_storeu_ps(&y[i], _mm_mul_ps(r, s));
+        _mm_storeu_ps(&z[i], zs);
+    }
+#endif
+    for (; i < count; i++) {
+        vec3s d = sampling_unit_sphere_one(u1[i], u2[i]);
+        x[i] = d.x;
+        y[i] = d.y;
+        z[i] = d.z;
+    }
+}
+
+void sampling_cosine_hemisphere(const float *u1, const float *u2,
+                                size_t count, float *x, float *y, float *z) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 u = _mm_loadu_ps(&u1[i]);
+        __m128 r = _mm_sqrt_ps(u);
+        __m128 s, c;
+        sampling_sincos4(_mm_loadu_ps(&u2[i]), &s, &c);
+        _mm_storeu_ps(&x[i], _mm_mul_ps(r, c));
+        _mm_storeu_ps(&y[i], _mm_mul_ps(r, s));
+        _mm_storeu_ps(&z[i],
+                      _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(),
+                                             _mm_sub_ps(_mm_set1_ps(1), u))));
+    }
+#endif
+    for (; i < count; i++) {
+        vec3s d = sampling_cosine_hemisphere_one(u1[i], u2[i]);
+        x[i] = d.x;
+        y[i] = d.y;
+        z[i] = d.z;
+    }
+}
+
+void sampling_ggx(float alpha, const float *u1, const float *u2, size_t count,
+                  float *x, float *y, float *z) {
+    // cos^2 theta = (1 - u) / (1 + (alpha^2 - 1) u), no tan or atan needed
+    float a2_minus_1 = alpha * alpha - 1;
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 u = _mm_loadu_ps(&u1[i]);
+        __m128 cos2 = _mm_div_ps(
+            _mm_sub_ps(_mm_set1_ps(1), u),
+            _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(_mm_set1_ps(a2_minus_1), u)));
+        __m128 sin_theta = _mm_sqrt_ps(
+            _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1), cos2)));
+        __m128 s, c;
+        sampling_sincos4(_mm_loadu_ps(&u2[i]), &s, &c);
+        _mm_storeu_ps(&x[i], _mm_mul_ps(sin_theta, c));
+        _mm_storeu_ps(&y[i], _mm_mul_ps(sin_theta, s));
+        _mm_storeu_ps(&z[i], _mm_sqrt_ps(cos2));
+    }
+#endif
+    for (; i < count; i++) {
+        float cos2 = (1 - u1[i]) / (1 + a2_minus_1 * u1[i]);
+        float sin_theta = sqrtf(fmaxf(0, 1 - cos2));
+        float s, c;
+        sampling_sincos_turns(u2[i], &s, &c);
+        x[i] = sin_theta * c;
+        y[i] = sin_theta * s;
+        z[i] = sqrtf(cos2);
+    }
+}
+
+void sampling_normal(const float *u1, const float *u2, size_t count,
+                     float *out1, float *out2) {
+    // 1 - u keeps the log argument in (0, 1]
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 u = _mm_sub_ps(_mm_set1_ps(1), _mm_loadu_ps(&u1[i]));
+        __m128 rho = _mm_sqrt_ps(
+            _mm_mul_ps(_mm_set1_ps(-2), sampling_log4(u)));
+        __m128 s, c;
+        sampling_sincos4(_mm_loadu_ps(&u2[i]), &s, &c);
+        _mm_storeu_ps(&out1[i], _mm_mul_ps(rho, c));
+        _mm_storeu_ps(&out2[i], _mm_mul_ps(rho, s));
+    }
+#endif
+    for (; i < count; i++) {
+        float rho = sqrtf(-2 * sampling_log(1 - u1[i]));
+        float s, c;
+        sampling_sincos_turns(u2[i], &s, &c);
+        out1[i] = rho * c;
+        out2[i] = rho * s;
+    }
+}
+
+void sampling_normalize(float *x, float *y, float *z, size_t count) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 vx = _mm_loadu_ps(&x[i]), vy = _mm_loadu_ps(&y[i]),
+               vz = _mm_loadu_ps(&z[i]);
+        __m128 length2 = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+            _mm_mul_ps(vz, vz));
+        __m128 scale = sampling_rsqrt4(length2);
+        _mm_storeu_ps(&x[i], _mm_mul_ps(vx, scale));
+        _mm_storeu_ps(&y[i], _mm_mul_ps(vy, scale));
+        _mm_storeu_ps(&z[i], _mm_mul_ps(vz, scale));
+    }
+#endif
+    for (; i < count; i++) {
+        float scale =
+            sampling_rsqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        x[i] *= scale;
+        y[i] *= scale;
+        z[i] *= scale;
+    }
+}
@@ -0,0 +1,166 @@
+#include "sampling.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_COUNT (1 << 20)
+#define BENCH_ROUNDS 20
+#define RANDOM_MAX 0x7FFFFFFF
+
+// Keeps results alive so the compiler cannot drop the work
+volatile float bench_sink;
+
+uint64_t bench_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// What renderer.c used before: a random cube point, normalized
+vec3s bench_cube_sphere() {
+    vec3s v = {(double)random() / (double)RANDOM_MAX,
+               (double)random() / (double)RANDOM_MAX,
+               (double)random() / (double)RANDOM_MAX};
+    v = glms_vec3_sub(glms_vec3_scale(v, 2), glms_vec3_one());
+    return glms_vec3_normalize(v);
+}
+
+// What the shader used before: Box-Muller three times, then normalized
+float bench_box_muller(float u1, float u2) {
+    return sqrtf(-2 * logf(1 - u1)) * cosf(2 * M_PI * u2);
+}
+
+vec3s bench_gaussian_sphere(const float *u) {
+    vec3s v = {bench_box_muller(u[0], u[1]), bench_box_muller(u[2], u[3]),
+               bench_box_muller(u[4], u[5])};
+    return glms_vec3_normalize(v);
+}
+
+void bench_report(const char *name, uint64_t ns, size_t samples) {
+    printf("  %-34s %7.2f ns/sample\n", name, (double)ns / samples);
+}
+
+int main() {
+    float *u = malloc(6 * BENCH_COUNT * sizeof(float));
+    float *x = malloc(BENCH_COUNT * sizeof(float));
+    float *y = malloc(BENCH_COUNT * sizeof(float));
+    float *z = malloc(BENCH_COUNT * sizeof(float));
+    srandom(1);
+    for (size_t i = 0; i < 6 * BENCH_COUNT; i++)
+        u[i] = (double)random() / ((double)RANDOM_MAX + 1.0);
+    float *u1 = u, *u2 = u + BENCH_COUNT;
+
+    // Largest errors against double precision libm, scalar functions first,
+    // then the batches that go through the SIMD versions
+    double sincos_error = 0, log_error = 0;
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        float s, c;
+        sampling_sincos_turns(u1[i], &s, &c);
+        sincos_error = fmax(sincos_error, fabs(s - sin(2 * M_PI * u1[i])));
+        sincos_error = fmax(sincos_error, fabs(c - cos(2 * M_PI * u1[i])));
+        log_error = fmax(log_error,
+                         fabs(sampling_log(1 - u2[i]) - log(1 - u2[i])));
+    }
+    printf("Max error, scalar: sincos %.2e, log %.2e\n", sincos_error,
+           log_error);
+
+    double sphere_error = 0, normal_error = 0, normalize_error = 0;
+    sampling_unit_sphere(u1, u2, BENCH_COUNT, x, y, z);
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        double r = sqrt(fmax(0, 1 - pow(1 - 2.0 * u1[i], 2)));
+        double phi = 2 * M_PI * u2[i];
+        sphere_error = fmax(sphere_error, fabs(x[i] - r * cos(phi)));
+        sphere_error = fmax(sphere_error, fabs(y[i] - r * sin(phi)));
+    }
+    sampling_normal(u1, u2, BENCH_COUNT, x, y);
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        double rho = sqrt(-2 * log(1 - (double)u1[i]));
+        normal_error =
+            fmax(normal_error, fabs(x[i] - rho * cos(2 * M_PI * u2[i])));
+    }
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        x[i] = u1[i] - 0.5f;
+        y[i] = u2[i] - 0.5f;
+        z[i] = u[2 * BENCH_COUNT + i] + 0.1f;
+    }
+    sampling_normalize(x, y, z, BENCH_COUNT);
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        double length = sqrt((double)x[i] * x[i] + (double)y[i] * y[i] +
+                             (double)z[i] * z[i]);
+        normalize_error = fmax(normalize_error, fabs(length - 1));
+    }
+    printf("Max error, batch: unit sphere %.2e, normal %.2e, normalize "
+           "%.2e\n",
+           sphere_error, normal_error, normalize_error);
+
+    printf("Unit sphere directions:\n");
+    uint64_t start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+            bench_sink = bench_cube_sphere().x;
+    bench_report("random() cube, normalized", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+            bench_sink = bench_gaussian_sphere(&u[6 * i]).x;
+    bench_report("Box-Muller x3, normalized", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+            bench_sink = sampling_unit_sphere_one(u1[i], u2[i]).x;
+    bench_report("sampling_unit_sphere_one", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        sampling_unit_sphere(u1, u2, BENCH_COUNT, x, y, z);
+        bench_sink = x[round];
+    }
+    bench_report("sampling_unit_sphere, batch", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    printf("Other distributions, batch:\n");
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        sampling_cosine_hemisphere(u1, u2, BENCH_COUNT, x, y, z);
+        bench_sink = x[round];
+    }
+    bench_report("sampling_cosine_hemisphere", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        sampling_ggx(0.3f, u1, u2, BENCH_COUNT, x, y, z);
+        bench_sink = x[round];
+    }
+    bench_report("sampling_ggx", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+            bench_sink = bench_box_muller(u1[i], u2[i]);
+    bench_report("Box-Muller, libm", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    start = bench_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        sampling_normal(u1, u2, BENCH_COUNT, x, y);
+        bench_sink = x[round];
+    }
+    bench_report("sampling_normal (two per sample)", bench_ns() - start,
+                 BENCH_ROUNDS * BENCH_COUNT);
+
+    free(u);
+    free(x);
+    free(y);
+    free(z);
+    return 0;
+}
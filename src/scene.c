@@ -1,29 +1,137 @@
 #include "scene.h"
+#include "scene_file.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
 
 // --- Private ---
 
+// Grow an array to hold capacity elements, keeping it cache-line aligned
+void *scene_realloc_aligned(void *data, size_t size, size_t capacity,
+                            size_t element_size) {
+    size_t bytes = capacity * element_size;
+    bytes = (bytes + PRIMITIVE_ALIGNMENT - 1) / PRIMITIVE_ALIGNMENT *
+            PRIMITIVE_ALIGNMENT;
+
+    void *extended = aligned_alloc(PRIMITIVE_ALIGNMENT, bytes);
+    if (data != NULL) {
+        memcpy(extended, data, size * element_size);
+        free(data);
+    }
+    return extended;
+}
+
 void scene_extend_materials(scene *s) {
     s->max_materials *= 2;
     s->materials =
         realloc(s->materials, s->max_materials * sizeof(shape_material));
+    s->hot_materials = scene_realloc_aligned(
+        s->hot_materials, s->num_materials, s->max_materials,
+        sizeof(hot_material));
+}
+
+void scene_extend_spheres(scene *s) {
+    s->max_spheres *= 2;
+    s->spheres = scene_realloc_aligned(s->spheres, s->num_spheres,
+                                       s->max_spheres, sizeof(sphere));
+    s->sphere_materials =
+        realloc(s->sphere_materials, s->max_spheres * sizeof(material_index));
+}
+
+void scene_extend_triangles(scene *s) {
+    s->max_triangles *= 2;
+    s->triangles = scene_realloc_aligned(s->triangles, s->num_triangles,
+                                         s->max_triangles, sizeof(triangle));
+    s->triangle_materials = realloc(s->triangle_materials,
+                                    s->max_triangles * sizeof(material_index));
+}
+
+// Writes both copies of a material, the renderer reads only the hot one
+void scene_store_material(scene *s, size_t index,
+                          const shape_material *material) {
+    s->hot_materials[index] = (hot_material){
+        .albedo = material->albedo,
+        .roughness = material->roughness,
+        .emission = glms_vec3_scale(material->emission_color,
+                                    material->emission_strength),
+        .transparency = material->transparency,
+    };
+    s->materials[index] = *material;
 }
 
-void scene_extend_objects(scene *s) {
-    s->max_objects *= 2;
-    s->objects = realloc(s->objects, s->max_objects * sizeof(shape));
+bool scene_finite(const vec3s v) {
+    return isfinite(v.x) && isfinite(v.y) && isfinite(v.z);
+}
+
+// Changes whenever anything a camera ray can hit changes
+uint64_t scene_hash_geometry(const scene *s) {
+    // Stored when packing, hashing would page in the whole file
+    if (s->mapping != NULL)
+        return s->mapping->geometry_hash;
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = scene_hash_bytes(hash, &s->num_spheres, sizeof(size_t));
+    hash = scene_hash_bytes(hash, s->spheres, s->num_spheres * sizeof(sphere));
+    hash = scene_hash_bytes(hash, s->sphere_materials,
+                            s->num_spheres * sizeof(material_index));
+    hash = scene_hash_bytes(hash, &s->num_triangles, sizeof(size_t));
+    hash = scene_hash_bytes(hash, s->triangles,
+                            s->num_triangles * sizeof(triangle));
+    hash = scene_hash_bytes(hash, s->triangle_materials,
+                            s->num_triangles * sizeof(material_index));
+    return hash;
+}
+
+uint64_t scene_hash_content(const scene *s, uint64_t geometry_hash) {
+    uint64_t hash = geometry_hash;
+    hash = scene_hash_bytes(hash, &s->num_materials, sizeof(size_t));
+    hash = scene_hash_bytes(hash, s->hot_materials,
+                            s->num_materials * sizeof(hot_material));
+    hash = scene_hash_bytes(hash, &s->sky_color, sizeof(vec3s));
+    return hash;
 }
 
 // --- Public ---
 
+uint64_t scene_hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
 void scene_init(scene *s) {
-    s->max_objects = 64;
-    s->objects = calloc(s->max_objects, sizeof(shape));
-    s->num_objects = 0;
+    s->max_spheres = 32;
+    s->spheres =
+        scene_realloc_aligned(NULL, 0, s->max_spheres, sizeof(sphere));
+    s->sphere_materials = malloc(s->max_spheres * sizeof(material_index));
+    s->num_spheres = 0;
+
+    s->max_triangles = 32;
+    s->triangles =
+        scene_realloc_aligned(NULL, 0, s->max_triangles, sizeof(triangle));
+    s->triangle_materials = malloc(s->max_triangles * sizeof(material_index));
+    s->num_triangles = 0;
 
     s->max_materials = 16;
     s->materials = calloc(s->max_materials, sizeof(shape_material));
+    s->hot_materials = scene_realloc_aligned(NULL, 0, s->max_materials,
+                                             sizeof(hot_material));
     s->num_materials = 0;
+
+    s->sky_color = glms_vec3_zero();
+    bvh_init(&s->accel);
+    light_tree_init(&s->lights);
+    s->mapping = NULL;
+    wide_bvh_init(&s->compact_accel);
+    s->hashed = false;
 }
 
 size_t scene_add_material(scene *s, const vec3s albedo, const float roughness,
@@ -31,10 +139,18 @@ size_t scene_add_material(scene *s, const vec3s albedo, const float roughness,
                           const float emission_strength,
                           const float transparency,
                           const float refractive_index) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Cannot add materials to a mapped scene\n");
+        return SIZE_MAX;
+    }
+    if (s->num_materials == MAX_MATERIALS) {
+        fprintf(stderr, "Scenes hold at most %d materials\n", MAX_MATERIALS);
+        return SIZE_MAX;
+    }
     if (s->num_materials == s->max_materials)
         scene_extend_materials(s);
 
-    s->materials[s->num_materials++] = (shape_material){
+    shape_material material = {
         .albedo = albedo,
         .roughness = roughness,
         .metallicity = metallicity,
@@ -43,34 +159,309 @@ size_t scene_add_material(scene *s, const vec3s albedo, const float roughness,
         .transparency = transparency,
         .refractive_index = refractive_index,
     };
+    scene_store_material(s, s->num_materials++, &material);
     return s->num_materials - 1;
 }
 
-void scene_add_sphere(scene *s, const vec3s center, const float radius,
-                      const size_t material) {
-    if (s->num_objects == s->max_objects)
-        scene_extend_objects(s);
+int scene_set_material(scene *s, size_t index,
+                       const shape_material *material) {
+    if (index >= s->num_materials) {
+        fprintf(stderr, "No material %zu in the scene\n", index);
+        return -1;
+    }
 
-    s->objects[s->num_objects++] = (shape){
-        .tag = SPHERE,
-        .material = material,
-        .sphere = {.center = center, .radius = radius},
-    };
+    // Lights are picked by emission, a stale tree could miss new emitters
+    vec3s emission = s->hot_materials[index].emission;
+    scene_store_material(s, index, material);
+    if (!glms_vec3_eqv(emission, s->hot_materials[index].emission))
+        light_tree_destroy(&s->lights);
+    return 0;
 }
 
-void scene_add_triangle(scene *s, const vec3s v0, const vec3s v1,
-                        const vec3s v2, const size_t material) {
-    if (s->num_objects == s->max_objects)
-        scene_extend_objects(s);
+int scene_add_sphere(scene *s, const vec3s center, const float radius,
+                     const size_t material) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Cannot add spheres to a mapped scene\n");
+        return -1;
+    }
+    if (material >= s->num_materials) {
+        fprintf(stderr, "No material %zu for the sphere\n", material);
+        return -1;
+    }
+    if (s->num_spheres == s->max_spheres)
+        scene_extend_spheres(s);
+    bvh_destroy(&s->accel);
+    light_tree_destroy(&s->lights);
+    s->hashed = false;
 
-    s->objects[s->num_objects++] = (shape){
-        .tag = TRIANGLE,
-        .material = material,
-        .triangle = {.v0 = v0, .v1 = v1, .v2 = v2},
-    };
+    s->spheres[s->num_spheres] = (sphere){.center = center, .radius = radius};
+    s->sphere_materials[s->num_spheres++] = material;
+    return 0;
+}
+
+int scene_add_triangle(scene *s, const vec3s v0, const vec3s v1,
+                       const vec3s v2, const size_t material) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Cannot add triangles to a mapped scene\n");
+        return -1;
+    }
+    if (material >= s->num_materials) {
+        fprintf(stderr, "No material %zu for the triangle\n", material);
+        return -1;
+    }
+    if (s->num_triangles == s->max_triangles)
+        scene_extend_triangles(s);
+    bvh_destroy(&s->accel);
+    light_tree_destroy(&s->lights);
+    s->hashed = false;
+
+    s->triangles[s->num_triangles] = (triangle){.v0 = v0, .v1 = v1, .v2 = v2};
+    s->triangle_materials[s->num_triangles++] = material;
+    return 0;
+}
+
+void scene_set_sky(scene *s, const vec3s sky_color) {
+    s->sky_color = sky_color;
+}
+
+int scene_set_sphere(scene *s, size_t index, const vec3s center,
+                     const float radius, const size_t material) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Cannot edit spheres of a mapped scene\n");
+        return -1;
+    }
+    if (index >= s->num_spheres || material >= s->num_materials) {
+        fprintf(stderr, "No sphere %zu or material %zu in the scene\n", index,
+                material);
+        return -1;
+    }
+    bvh_destroy(&s->accel);
+    light_tree_destroy(&s->lights);
+    s->hashed = false;
+
+    s->spheres[index] = (sphere){.center = center, .radius = radius};
+    s->sphere_materials[index] = material;
+    return 0;
+}
+
+int scene_set_triangle(scene *s, size_t index, const vec3s v0,
+                       const vec3s v1, const vec3s v2, const size_t material) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Cannot edit triangles of a mapped scene\n");
+        return -1;
+    }
+    if (index >= s->num_triangles || material >= s->num_materials) {
+        fprintf(stderr, "No triangle %zu or material %zu in the scene\n",
+                index, material);
+        return -1;
+    }
+    bvh_destroy(&s->accel);
+    light_tree_destroy(&s->lights);
+    s->hashed = false;
+
+    s->triangles[index] = (triangle){.v0 = v0, .v1 = v1, .v2 = v2};
+    s->triangle_materials[index] = material;
+    return 0;
+}
+
+size_t scene_num_primitives(const scene *s) {
+    return s->num_spheres + s->num_triangles;
+}
+
+material_index scene_primitive_material(const scene *s, size_t prim) {
+    if (prim < s->num_spheres)
+        return s->sphere_materials[prim];
+    return s->triangle_materials[prim - s->num_spheres];
+}
+
+void scene_primitive_bounds(const scene *s, size_t prim, vec3s *min,
+                            vec3s *max) {
+    if (prim < s->num_spheres) {
+        const sphere *sph = &s->spheres[prim];
+        vec3s radius = glms_vec3_broadcast(sph->radius);
+        *min = glms_vec3_sub(sph->center, radius);
+        *max = glms_vec3_add(sph->center, radius);
+    } else {
+        const triangle *tri = &s->triangles[prim - s->num_spheres];
+        *min = glms_vec3_minv(tri->v0, glms_vec3_minv(tri->v1, tri->v2));
+        *max = glms_vec3_maxv(tri->v0, glms_vec3_maxv(tri->v1, tri->v2));
+    }
+}
+
+void scene_update_geometry_hash(scene *s) {
+    s->geometry_hash = scene_hash_geometry(s);
+    s->hashed = true;
+}
+
+uint64_t scene_geometry_hash(const scene *s) {
+    return s->hashed ? s->geometry_hash : scene_hash_geometry(s);
+}
+
+uint64_t scene_content_hash(const scene *s) {
+    // Materials and sky are a few bytes, hashing them every time means no
+    // edit can leave a stale key behind
+    return scene_hash_content(s, scene_geometry_hash(s));
+}
+
+void scene_build_accel(scene *s) {
+    // Mapped scenes come with their compact tree
+    if (s->mapping != NULL)
+        return;
+
+    size_t num_prims = scene_num_primitives(s);
+    vec3s *prim_min = malloc(num_prims * sizeof(vec3s));
+    vec3s *prim_max = malloc(num_prims * sizeof(vec3s));
+
+    for (size_t i = 0; i < num_prims; i++)
+        scene_primitive_bounds(s, i, &prim_min[i], &prim_max[i]);
+
+    bvh_build(&s->accel, prim_min, prim_max, num_prims);
+
+    free(prim_min);
+    free(prim_max);
+}
+
+void scene_build_lights(scene *s) {
+    size_t num_prims = scene_num_primitives(s);
+    light_info *lights = malloc(num_prims * sizeof(light_info));
+    size_t num_lights = 0;
+
+    for (size_t i = 0; i < num_prims; i++) {
+        vec3s emission =
+            s->hot_materials[scene_primitive_material(s, i)].emission;
+        float luminance = 0.2126f * emission.r + 0.7152f * emission.g +
+                          0.0722f * emission.b;
+        if (luminance <= 0)
+            continue;
+
+        light_info *light = &lights[num_lights++];
+        light->primitive = i;
+        scene_primitive_bounds(s, i, &light->min, &light->max);
+
+        // Power of a diffuse emitter is pi * radiance * area
+        if (i < s->num_spheres) {
+            float radius = s->spheres[i].radius;
+            light->axis = (vec3s){0, 0, 1};
+            light->omni = true;
+            light->two_sided = false;
+            light->power = M_PI * luminance * 4 * M_PI * radius * radius;
+        } else {
+            const triangle *tri = &s->triangles[i - s->num_spheres];
+            vec3s cross = glms_vec3_cross(glms_vec3_sub(tri->v1, tri->v0),
+                                          glms_vec3_sub(tri->v2, tri->v0));
+            float area = 0.5f * glms_vec3_norm(cross);
+            light->axis = glms_vec3_normalize(cross);
+            light->omni = false;
+            light->two_sided = true;
+            light->power = M_PI * luminance * 2 * area;
+        }
+    }
+
+    light_tree_build(&s->lights, lights, num_lights);
+    free(lights);
+}
+
+void scene_bounds(const scene *s, vec3s *min, vec3s *max) {
+    if (s->compact_accel.num_nodes > 0) {
+        wide_bvh_bounds(&s->compact_accel, min, max);
+        return;
+    }
+
+    *min = glms_vec3_broadcast(INFINITY);
+    *max = glms_vec3_broadcast(-INFINITY);
+
+    for (size_t i = 0; i < scene_num_primitives(s); i++) {
+        vec3s prim_min, prim_max;
+        scene_primitive_bounds(s, i, &prim_min, &prim_max);
+        *min = glms_vec3_minv(*min, prim_min);
+        *max = glms_vec3_maxv(*max, prim_max);
+    }
+}
+
+int scene_load(scene *s, const char *filepath) {
+    FILE *fp = fopen(filepath, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open file: %s\n", filepath);
+        return -1;
+    }
+
+    scene_init(s);
+
+    char line[512];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+
+        char keyword[16];
+        int consumed;
+        if (sscanf(line, "%15s%n", keyword, &consumed) != 1 ||
+            keyword[0] == '#')
+            continue;
+        const char *args = line + consumed;
+
+        bool parsed = false;
+        size_t material;
+        if (strcmp(keyword, "sky") == 0) {
+            vec3s c;
+            parsed = sscanf(args, "%f %f %f", &c.x, &c.y, &c.z) == 3;
+            if (parsed)
+                scene_set_sky(s, c);
+        } else if (strcmp(keyword, "material") == 0) {
+            vec3s albedo, emission_color;
+            float roughness, metallicity, emission_strength, transparency,
+                refractive_index;
+            parsed = sscanf(args, "%f %f %f %f %f %f %f %f %f %f %f",
+                            &albedo.x, &albedo.y, &albedo.z, &roughness,
+                            &metallicity, &emission_color.x,
+                            &emission_color.y, &emission_color.z,
+                            &emission_strength, &transparency,
+                            &refractive_index) == 11 &&
+                     scene_add_material(s, albedo, roughness, metallicity,
+                                        emission_color, emission_strength,
+                                        transparency,
+                                        refractive_index) != SIZE_MAX;
+        } else if (strcmp(keyword, "sphere") == 0) {
+            vec3s center;
+            float radius;
+            parsed = sscanf(args, "%f %f %f %f %zu", &center.x, &center.y,
+                            &center.z, &radius, &material) == 5 &&
+                     scene_finite(center) && isfinite(radius) &&
+                     scene_add_sphere(s, center, radius, material) == 0;
+        } else if (strcmp(keyword, "triangle") == 0) {
+            vec3s v0, v1, v2;
+            parsed = sscanf(args, "%f %f %f %f %f %f %f %f %f %zu", &v0.x,
+                            &v0.y, &v0.z, &v1.x, &v1.y, &v1.z, &v2.x, &v2.y,
+                            &v2.z, &material) == 10 &&
+                     scene_finite(v0) && scene_finite(v1) &&
+                     scene_finite(v2) &&
+                     scene_add_triangle(s, v0, v1, v2, material) == 0;
+        }
+
+        if (!parsed) {
+            fprintf(stderr, "Invalid scene line %d in %s: %s", line_number,
+                    filepath, line);
+            fclose(fp);
+            scene_destroy(s);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    scene_update_geometry_hash(s);
+    return 0;
 }
 
 void scene_destroy(scene *s) {
-    free(s->objects);
+    if (s->mapping != NULL)
+        scene_file_unmap(s);
+
+    free(s->spheres);
+    free(s->sphere_materials);
+    free(s->triangles);
+    free(s->triangle_materials);
     free(s->materials);
+    free(s->hot_materials);
+    bvh_destroy(&s->accel);
+    light_tree_destroy(&s->lights);
+    wide_bvh_destroy(&s->compact_accel);
 }
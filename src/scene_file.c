@@ -0,0 +1,434 @@
+#include "scene_file.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Evicts clean file pages from the page cache too, not just our page tables
+#ifdef MADV_PAGEOUT
+#define SCENE_FILE_EVICT MADV_PAGEOUT
+#else
+#define SCENE_FILE_EVICT MADV_DONTNEED
+#endif
+
+// --- Private ---
+
+size_t scene_file_align(size_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT *
+           SCENE_FILE_ALIGNMENT;
+}
+
+// Reserves a page-aligned section and returns its offset
+uint64_t scene_file_section(uint64_t *end, size_t size) {
+    uint64_t offset = scene_file_align(*end);
+    *end = offset + size;
+    return offset;
+}
+
+bool scene_file_put(FILE *fp, uint64_t offset, const void *data,
+                    size_t size) {
+    if (size == 0)
+        return true;
+    return fseek(fp, offset, SEEK_SET) == 0 &&
+           fwrite(data, 1, size, fp) == size;
+}
+
+bool scene_file_section_valid(const scene_file_header *header,
+                              uint64_t offset, uint64_t count,
+                              size_t element_size) {
+    return offset % PRIMITIVE_ALIGNMENT == 0 && offset <= header->file_size &&
+           count <= (header->file_size - offset) / element_size;
+}
+
+bool scene_file_header_valid(const scene_file_header *header) {
+    return memcmp(header->magic, SCENE_FILE_MAGIC,
+                  sizeof(SCENE_FILE_MAGIC)) == 0 &&
+           header->version == SCENE_FILE_VERSION &&
+           scene_file_section_valid(header, header->materials_offset,
+                                    header->num_materials,
+                                    sizeof(shape_material)) &&
+           scene_file_section_valid(header, header->nodes_offset,
+                                    header->num_nodes,
+                                    sizeof(wide_bvh_node)) &&
+           scene_file_section_valid(header, header->indices_offset,
+                                    header->num_indices, sizeof(uint32_t)) &&
+           scene_file_section_valid(header, header->spheres_offset,
+                                    header->num_spheres, sizeof(sphere)) &&
+           scene_file_section_valid(header, header->sphere_materials_offset,
+                                    header->num_spheres,
+                                    sizeof(material_index)) &&
+           scene_file_section_valid(header, header->triangles_offset,
+                                    header->num_triangles,
+                                    sizeof(triangle)) &&
+           scene_file_section_valid(header,
+                                    header->triangle_materials_offset,
+                                    header->num_triangles,
+                                    sizeof(material_index));
+}
+
+// Every index the renderer follows must land inside its section. Child
+// nodes must come after their parents, so the tree has no cycles and its
+// depth fits the traversal stacks.
+bool scene_file_contents_valid(const uint8_t *data,
+                               const scene_file_header *header) {
+    if (header->num_materials > MAX_MATERIALS)
+        return false;
+
+    const material_index *sphere_materials =
+        (const material_index *)(data + header->sphere_materials_offset);
+    for (uint64_t i = 0; i < header->num_spheres; i++)
+        if (sphere_materials[i] >= header->num_materials)
+            return false;
+    const material_index *triangle_materials =
+        (const material_index *)(data + header->triangle_materials_offset);
+    for (uint64_t i = 0; i < header->num_triangles; i++)
+        if (triangle_materials[i] >= header->num_materials)
+            return false;
+
+    uint64_t num_prims = header->num_spheres + header->num_triangles;
+    const uint32_t *indices = (const uint32_t *)(data + header->indices_offset);
+    for (uint64_t i = 0; i < header->num_indices; i++)
+        if (indices[i] >= num_prims)
+            return false;
+
+    const wide_bvh_node *nodes =
+        (const wide_bvh_node *)(data + header->nodes_offset);
+    uint8_t *depth = calloc(header->num_nodes, sizeof(uint8_t));
+    bool valid = true;
+    for (uint64_t i = 0; i < header->num_nodes && valid; i++) {
+        const wide_bvh_node *node = &nodes[i];
+        valid = node->num_children <= WIDE_BVH_WIDTH;
+        for (size_t c = 0; valid && c < node->num_children; c++) {
+            uint64_t child = node->child[c];
+            if (node->count[c] > 0) {
+                valid = child + node->count[c] <= header->num_indices;
+                continue;
+            }
+
+            valid = child > i && child < header->num_nodes &&
+                    depth[i] < BVH_MAX_DEPTH;
+            if (valid && depth[child] < depth[i] + 1)
+                depth[child] = depth[i] + 1;
+        }
+    }
+    free(depth);
+    return valid;
+}
+
+// Which pages of the file are in memory, whether or not they are mapped
+// into our page tables. NULL if that cannot be queried.
+unsigned char *scene_file_pages(const scene_mapping *m, size_t *num_pages) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    *num_pages = (m->size + page_size - 1) / page_size;
+    unsigned char *pages = malloc(*num_pages);
+    if (mincore(m->data, m->size, pages) != 0) {
+        free(pages);
+        return NULL;
+    }
+    return pages;
+}
+
+size_t scene_file_count_pages(const unsigned char *pages, size_t num_pages) {
+    size_t resident = 0;
+    for (size_t i = 0; i < num_pages; i++)
+        resident += pages[i] & 1;
+    return resident;
+}
+
+size_t scene_file_resident(const scene_mapping *m) {
+    size_t num_pages;
+    unsigned char *pages = scene_file_pages(m, &num_pages);
+    if (pages == NULL)
+        return 0;
+
+    size_t resident = scene_file_count_pages(pages, num_pages);
+    free(pages);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Page faults of the whole process, an upper bound on pages brought in
+long scene_file_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// --- Public ---
+
+int scene_file_write(scene *s, const char *filepath) {
+    if (s->mapping != NULL) {
+        fprintf(stderr, "Scene is already packed\n");
+        return -1;
+    }
+
+    if (s->accel.num_nodes == 0)
+        scene_build_accel(s);
+    wide_bvh compact;
+    wide_bvh_init(&compact);
+    if (wide_bvh_build(&compact, &s->accel) != 0)
+        return -1;
+
+    scene_file_header header = {
+        .version = SCENE_FILE_VERSION,
+        .num_materials = s->num_materials,
+        .num_spheres = s->num_spheres,
+        .num_triangles = s->num_triangles,
+        .num_nodes = compact.num_nodes,
+        .num_indices = compact.num_indices,
+        .geometry_hash = scene_geometry_hash(s),
+        .sky_color = s->sky_color,
+    };
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+
+    uint64_t end = sizeof(scene_file_header);
+    header.materials_offset =
+        scene_file_section(&end, s->num_materials * sizeof(shape_material));
+    header.nodes_offset =
+        scene_file_section(&end, compact.num_nodes * sizeof(wide_bvh_node));
+    header.indices_offset =
+        scene_file_section(&end, compact.num_indices * sizeof(uint32_t));
+    header.spheres_offset =
+        scene_file_section(&end, s->num_spheres * sizeof(sphere));
+    header.sphere_materials_offset =
+        scene_file_section(&end, s->num_spheres * sizeof(material_index));
+    header.triangles_offset =
+        scene_file_section(&end, s->num_triangles * sizeof(triangle));
+    header.triangle_materials_offset =
+        scene_file_section(&end, s->num_triangles * sizeof(material_index));
+    header.file_size = end;
+
+    FILE *fp = fopen(filepath, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open file: %s\n", filepath);
+        wide_bvh_destroy(&compact);
+        return -1;
+    }
+
+    bool written =
+        scene_file_put(fp, 0, &header, sizeof(header)) &&
+        scene_file_put(fp, header.materials_offset, s->materials,
+                       s->num_materials * sizeof(shape_material)) &&
+        scene_file_put(fp, header.nodes_offset, compact.nodes,
+                       compact.num_nodes * sizeof(wide_bvh_node)) &&
+        scene_file_put(fp, header.indices_offset, compact.indices,
+                       compact.num_indices * sizeof(uint32_t)) &&
+        scene_file_put(fp, header.spheres_offset, s->spheres,
+                       s->num_spheres * sizeof(sphere)) &&
+        scene_file_put(fp, header.sphere_materials_offset,
+                       s->sphere_materials,
+                       s->num_spheres * sizeof(material_index)) &&
+        scene_file_put(fp, header.triangles_offset, s->triangles,
+                       s->num_triangles * sizeof(triangle)) &&
+        scene_file_put(fp, header.triangle_materials_offset,
+                       s->triangle_materials,
+                       s->num_triangles * sizeof(material_index));
+    written = fclose(fp) == 0 && written;
+    wide_bvh_destroy(&compact);
+
+    if (!written) {
+        fprintf(stderr, "Failed to write scene file: %s\n", filepath);
+        return -1;
+    }
+    return 0;
+}
+
+bool scene_file_detect(const char *filepath) {
+    FILE *fp = fopen(filepath, "rb");
+    if (fp == NULL)
+        return false;
+
+    char magic[sizeof(SCENE_FILE_MAGIC)];
+    bool detected = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                    memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return detected;
+}
+
+int scene_file_map(scene *s, const char *filepath, size_t resident_budget) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open file: %s\n", filepath);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(scene_file_header)) {
+        fprintf(stderr, "Not a scene file: %s\n", filepath);
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map file: %s\n", filepath);
+        return -1;
+    }
+
+    // Files may come from clients, check every index before following any
+    const scene_file_header *header = (const scene_file_header *)data;
+    if (header->file_size != (uint64_t)st.st_size ||
+        !scene_file_header_valid(header) ||
+        !scene_file_contents_valid(data, header)) {
+        fprintf(stderr, "Invalid scene file: %s\n", filepath);
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    // Rays jump around the file, read-ahead would only evict useful pages
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    // Materials are few and read on every hit, keep them on the heap
+    scene_init(s);
+    s->sky_color = header->sky_color;
+    const shape_material *materials =
+        (const shape_material *)(data + header->materials_offset);
+    for (size_t i = 0; i < header->num_materials; i++)
+        scene_add_material(s, materials[i].albedo, materials[i].roughness,
+                           materials[i].metallicity,
+                           materials[i].emission_color,
+                           materials[i].emission_strength,
+                           materials[i].transparency,
+                           materials[i].refractive_index);
+
+    free(s->spheres);
+    free(s->sphere_materials);
+    s->spheres = (sphere *)(data + header->spheres_offset);
+    s->sphere_materials =
+        (material_index *)(data + header->sphere_materials_offset);
+    s->num_spheres = s->max_spheres = header->num_spheres;
+
+    free(s->triangles);
+    free(s->triangle_materials);
+    s->triangles = (triangle *)(data + header->triangles_offset);
+    s->triangle_materials =
+        (material_index *)(data + header->triangle_materials_offset);
+    s->num_triangles = s->max_triangles = header->num_triangles;
+
+    s->compact_accel.nodes = (wide_bvh_node *)(data + header->nodes_offset);
+    s->compact_accel.num_nodes = header->num_nodes;
+    s->compact_accel.indices = (uint32_t *)(data + header->indices_offset);
+    s->compact_accel.num_indices = header->num_indices;
+
+    // Keep the top of the tree in memory, every ray walks through it
+    size_t nodes_bytes = header->num_nodes * sizeof(wide_bvh_node);
+    size_t pinned_nodes = resident_budget / 4;
+    if (pinned_nodes > nodes_bytes)
+        pinned_nodes = nodes_bytes;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    scene_mapping *m = malloc(sizeof(scene_mapping));
+    *m = (scene_mapping){
+        .data = data,
+        .size = st.st_size,
+        .pinned_bytes =
+            scene_file_align(header->nodes_offset + pinned_nodes),
+        .budget_bytes = resident_budget,
+        .geometry_hash = header->geometry_hash,
+        .base_minor_faults = usage.ru_minflt,
+        .base_major_faults = usage.ru_majflt,
+        .base_blocks_read = usage.ru_inblock,
+        .resident_bound = st.st_size,
+        .fault_count = usage.ru_minflt + usage.ru_majflt,
+        .trims = 0,
+    };
+    s->mapping = m;
+    scene_update_geometry_hash(s);
+
+    // Validation paged in the whole file, give back what is over budget
+    scene_file_trim(s);
+    return 0;
+}
+
+void scene_file_trim(scene *s) {
+    scene_mapping *m = s->mapping;
+    if (m == NULL || m->budget_bytes == 0 || m->pinned_bytes >= m->size)
+        return;
+
+    // Pages only come in through faults, so there is nothing to measure
+    // until the process has faulted enough to possibly cross the budget
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    long faults = scene_file_faults();
+    m->resident_bound += (faults - m->fault_count) * page_size;
+    m->fault_count = faults;
+    if (m->resident_bound <= m->budget_bytes)
+        return;
+
+    size_t num_pages;
+    unsigned char *pages = scene_file_pages(m, &num_pages);
+    if (pages == NULL)
+        return;
+    size_t resident = scene_file_count_pages(pages, num_pages) * page_size;
+    size_t excess = 0; // In pages
+    if (resident > m->budget_bytes)
+        excess = (resident - m->budget_bytes + page_size - 1) / page_size;
+
+    // Drop just the excess, in runs of resident pages from the end of the
+    // file back towards the pinned prefix
+    size_t first = (m->pinned_bytes + page_size - 1) / page_size;
+    size_t end = num_pages;
+    bool trimmed = excess > 0;
+    while (excess > 0 && end > first) {
+        while (end > first && !(pages[end - 1] & 1))
+            end--;
+        size_t begin = end;
+        while (begin > first && (pages[begin - 1] & 1) &&
+               end - begin < excess)
+            begin--;
+        if (begin == end)
+            break;
+
+        if (madvise(m->data + begin * page_size, (end - begin) * page_size,
+                    SCENE_FILE_EVICT) != 0) {
+            trimmed = false;
+            break;
+        }
+        resident -= (end - begin) * page_size;
+        excess -= end - begin;
+        end = begin;
+    }
+    free(pages);
+
+    m->resident_bound = resident;
+    if (trimmed)
+        m->trims++;
+}
+
+scene_file_stats scene_file_get_stats(const scene *s) {
+    const scene_mapping *m = s->mapping;
+    if (m == NULL)
+        return (scene_file_stats){0};
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (scene_file_stats){
+        .mapped_bytes = m->size,
+        .resident_bytes = scene_file_resident(m),
+        .budget_bytes = m->budget_bytes,
+        .minor_faults = usage.ru_minflt - m->base_minor_faults,
+        .major_faults = usage.ru_majflt - m->base_major_faults,
+        .blocks_read = usage.ru_inblock - m->base_blocks_read,
+        .trims = m->trims,
+    };
+}
+
+void scene_file_unmap(scene *s) {
+    munmap(s->mapping->data, s->mapping->size);
+    free(s->mapping);
+    s->mapping = NULL;
+
+    s->spheres = NULL;
+    s->sphere_materials = NULL;
+    s->num_spheres = s->max_spheres = 0;
+    s->triangles = NULL;
+    s->triangle_materials = NULL;
+    s->num_triangles = s->max_triangles = 0;
+    wide_bvh_init(&s->compact_accel);
+    s->hashed = false;
+}
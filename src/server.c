@@ -0,0 +1,331 @@
+#include "server.h"
+#include "renderer.h"
+#include "scene_file.h"
+#include "tonemap.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Image a connection keeps between RENDER requests, so asking for the same
+// view again adds samples to it instead of starting over
+typedef struct {
+    framebuffer fb; // Zero-sized until the first render
+    char scene_id[SERVER_SCENE_ID_LENGTH];
+    uint64_t content_hash;
+    camera cam;
+    unsigned long long seed;
+    int guided;
+    uint8_t *pixels; // Tone mapped crop, grown as needed
+    size_t pixels_size;
+} server_view;
+
+// --- Private ---
+
+server_scene *server_find_scene(render_server *srv, const char *id) {
+    for (size_t i = 0; i < srv->num_scenes; i++)
+        if (strcmp(srv->scenes[i].id, id) == 0)
+            return &srv->scenes[i];
+    return NULL;
+}
+
+void server_remove_scene(render_server *srv, server_scene *entry) {
+    scene_destroy(&entry->world);
+    gbuffer_destroy(&entry->gbuf);
+    guiding_destroy(&entry->guide);
+    *entry = srv->scenes[--srv->num_scenes];
+}
+
+bool server_write(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool server_reply(int fd, const char *reply) {
+    return server_write(fd, reply, strlen(reply));
+}
+
+bool server_load(render_server *srv, int fd, const char *args) {
+    char id[SERVER_SCENE_ID_LENGTH], path[256];
+    if (sscanf(args, "%63s %255s", id, path) != 2)
+        return server_reply(fd, "ERR usage: LOAD <id> <scene file>\n");
+
+    // Packed scenes are mapped and paged in as rays touch them
+    scene world;
+    int loaded = scene_file_detect(path)
+                     ? scene_file_map(&world, path, srv->resident_budget)
+                     : scene_load(&world, path);
+    if (loaded != 0)
+        return server_reply(fd, "ERR failed to load scene\n");
+    scene_build_accel(&world);
+    scene_build_lights(&world);
+
+    // Replace a scene that is already loaded under the same id
+    server_scene *entry = server_find_scene(srv, id);
+    if (entry != NULL) {
+        scene_destroy(&entry->world);
+    } else {
+        if (srv->num_scenes == srv->max_scenes) {
+            srv->max_scenes *= 2;
+            srv->scenes =
+                realloc(srv->scenes, srv->max_scenes * sizeof(server_scene));
+        }
+        entry = &srv->scenes[srv->num_scenes++];
+        strcpy(entry->id, id);
+        gbuffer_init(&entry->gbuf);
+        guiding_init(&entry->guide);
+    }
+    entry->world = world;
+
+    char reply[64];
+    snprintf(reply, sizeof(reply), "OK %zu\n", scene_num_primitives(&world));
+    return server_reply(fd, reply);
+}
+
+bool server_unload(render_server *srv, int fd, const char *args) {
+    char id[SERVER_SCENE_ID_LENGTH];
+    if (sscanf(args, "%63s", id) != 1)
+        return server_reply(fd, "ERR usage: UNLOAD <id>\n");
+
+    server_scene *entry = server_find_scene(srv, id);
+    if (entry == NULL)
+        return server_reply(fd, "ERR unknown scene\n");
+
+    server_remove_scene(srv, entry);
+    return server_reply(fd, "OK\n");
+}
+
+bool server_stats(render_server *srv, int fd, const char *args) {
+    char id[SERVER_SCENE_ID_LENGTH];
+    if (sscanf(args, "%63s", id) != 1)
+        return server_reply(fd, "ERR usage: STATS <id>\n");
+
+    server_scene *entry = server_find_scene(srv, id);
+    if (entry == NULL)
+        return server_reply(fd, "ERR unknown scene\n");
+
+    scene_file_stats stats = scene_file_get_stats(&entry->world);
+    char reply[192];
+    snprintf(reply, sizeof(reply), "OK %zu %zu %zu %ld %ld %ld %zu\n",
+             stats.mapped_bytes, stats.resident_bytes, stats.budget_bytes,
+             stats.minor_faults, stats.major_faults, stats.blocks_read,
+             stats.trims);
+    return server_reply(fd, reply);
+}
+
+// Starts the accumulation over unless the request shows the same image
+void server_prepare_view(server_view *view, const char *id, const scene *world,
+                         size_t width, size_t height, const camera *cam,
+                         unsigned long long seed, int guided) {
+    uint64_t content_hash = scene_content_hash(world);
+    bool same_size = view->fb.width == width && view->fb.height == height;
+    if (same_size && strcmp(view->scene_id, id) == 0 &&
+        view->content_hash == content_hash &&
+        glms_vec3_eqv(view->cam.position, cam->position) &&
+        view->cam.fov == cam->fov && view->seed == seed &&
+        view->guided == guided)
+        return;
+
+    if (same_size) {
+        framebuffer_clear(&view->fb);
+    } else {
+        framebuffer_destroy(&view->fb);
+        framebuffer_init(&view->fb, width, height);
+    }
+    strcpy(view->scene_id, id);
+    view->content_hash = content_hash;
+    view->cam = *cam;
+    view->seed = seed;
+    view->guided = guided;
+}
+
+bool server_render(render_server *srv, server_view *view, int fd,
+                   const char *args) {
+    char id[SERVER_SCENE_ID_LENGTH];
+    size_t width, height, max_samples;
+    double budget_ms;
+    float fov_degrees;
+    camera cam;
+    int guided = 0;
+    unsigned long long seed = 0;
+    framebuffer_region crop = {0};
+    int parsed = sscanf(args,
+                        "%63s %zu %zu %lf %zu %f %f %f %f %d %llu %zu %zu "
+                        "%zu %zu",
+                        id, &width, &height, &budget_ms, &max_samples,
+                        &cam.position.x, &cam.position.y, &cam.position.z,
+                        &fov_degrees, &guided, &seed, &crop.x0, &crop.y0,
+                        &crop.x1, &crop.y1);
+    if (parsed < 9 || (parsed > 11 && parsed < 15) || width == 0 ||
+        height == 0)
+        return server_reply(fd, "ERR usage: RENDER <id> <width> <height> "
+                                "<budget ms> <max samples> <x> <y> <z> "
+                                "<fov> [guiding] [seed] "
+                                "[<x0> <y0> <x1> <y1>]\n");
+    if (width > srv->max_image_size)
+        width = srv->max_image_size;
+    if (height > srv->max_image_size)
+        height = srv->max_image_size;
+    if (parsed < 15)
+        crop = (framebuffer_region){0, 0, width, height};
+    if (crop.x0 >= crop.x1 || crop.y0 >= crop.y1 || crop.x1 > width ||
+        crop.y1 > height)
+        return server_reply(fd, "ERR crop outside the image\n");
+    if (budget_ms <= 0 && max_samples == 0)
+        return server_reply(fd, "ERR needs a budget or a sample limit\n");
+    cam.fov = fov_degrees * M_PI / 180.0f;
+
+    server_scene *entry = server_find_scene(srv, id);
+    if (entry == NULL)
+        return server_reply(fd, "ERR unknown scene\n");
+
+    server_prepare_view(view, id, &entry->world, width, height, &cam, seed,
+                        guided);
+    progressive_settings settings = {
+        .budget_ms = budget_ms,
+        .preview_scale = 8,
+        .max_samples = max_samples,
+        .gbuffer = &entry->gbuf,
+        .guiding = guided ? &entry->guide : NULL,
+        .seed = seed,
+        .cache = srv->cache,
+        .region = crop,
+    };
+    progressive_result result = render_progressive(
+        &srv->pool, &entry->world, &cam, &view->fb, &settings);
+
+    // Only the cropped rows are encoded and sent
+    size_t crop_width = crop.x1 - crop.x0, crop_height = crop.y1 - crop.y0;
+    size_t pixels_size = 3 * crop_width * crop_height;
+    if (pixels_size > view->pixels_size) {
+        view->pixels = realloc(view->pixels, pixels_size);
+        view->pixels_size = pixels_size;
+    }
+    tonemap_settings tone = tonemap_default();
+    tonemap_region(&srv->pool, &view->fb, &crop, &tone, view->pixels);
+
+    char reply[128];
+    snprintf(reply, sizeof(reply), "OK %zu %zu %u %.3f\n", crop_width,
+             crop_height, result.samples_per_pixel, result.elapsed_ms);
+    return server_reply(fd, reply) &&
+           server_write(fd, view->pixels, pixels_size);
+}
+
+void server_handle_connection(render_server *srv, int fd) {
+    FILE *in = fdopen(dup(fd), "r");
+    if (in == NULL)
+        return;
+
+    server_view view = {0};
+    char line[512];
+    while (srv->running && fgets(line, sizeof(line), in) != NULL) {
+        char command[16];
+        int consumed;
+        if (sscanf(line, "%15s%n", command, &consumed) != 1)
+            continue;
+        const char *args = line + consumed;
+
+        bool ok;
+        if (strcmp(command, "LOAD") == 0) {
+            ok = server_load(srv, fd, args);
+        } else if (strcmp(command, "UNLOAD") == 0) {
+            ok = server_unload(srv, fd, args);
+        } else if (strcmp(command, "RENDER") == 0) {
+            ok = server_render(srv, &view, fd, args);
+        } else if (strcmp(command, "STATS") == 0) {
+            ok = server_stats(srv, fd, args);
+        } else if (strcmp(command, "QUIT") == 0) {
+            break;
+        } else if (strcmp(command, "SHUTDOWN") == 0) {
+            srv->running = false;
+            ok = server_reply(fd, "OK\n");
+        } else {
+            ok = server_reply(fd, "ERR unknown command\n");
+        }
+
+        // Client went away mid-reply
+        if (!ok)
+            break;
+    }
+
+    framebuffer_destroy(&view.fb);
+    free(view.pixels);
+    fclose(in);
+}
+
+// --- Public ---
+
+int render_server_init(render_server *srv, const char *socket_path,
+                       size_t num_threads) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // Clients disconnecting mid-reply must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv->listen_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    unlink(socket_path);
+    if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(srv->listen_fd, 8) == -1) {
+        perror(socket_path);
+        close(srv->listen_fd);
+        return -1;
+    }
+    strcpy(srv->socket_path, socket_path);
+
+    srv->max_scenes = 4;
+    srv->scenes = malloc(srv->max_scenes * sizeof(server_scene));
+    srv->num_scenes = 0;
+    srv->resident_budget = 0;
+    srv->max_image_size = SERVER_MAX_IMAGE_SIZE;
+    srv->cache = NULL;
+    srv->running = true;
+
+    threadpool_init(&srv->pool, num_threads);
+    return 0;
+}
+
+void render_server_run(render_server *srv) {
+    while (srv->running) {
+        int fd = accept(srv->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            perror("accept");
+            continue;
+        }
+
+        server_handle_connection(srv, fd);
+        close(fd);
+    }
+}
+
+void render_server_destroy(render_server *srv) {
+    threadpool_destroy(&srv->pool);
+
+    while (srv->num_scenes > 0)
+        server_remove_scene(srv, &srv->scenes[0]);
+    free(srv->scenes);
+
+    close(srv->listen_fd);
+    unlink(srv->socket_path);
+}
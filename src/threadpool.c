@@ -6,34 +6,71 @@
 
 // --- Private ---
 
+#define PARALLEL_FOR_CHUNKS_PER_THREAD 4
+
 typedef struct {
     void (*task)(void *);
     void *arg;
+    task_group *group;
 } threadpool_task;
 
-void *threadpool_task_function(void *arg) {
-    threadpool *pool = (threadpool *)arg;
-    threadpool_task *task;
+typedef struct {
+    void (*f)(void *ctx, size_t begin, size_t end);
+    void *ctx;
+    size_t begin, end;
+} parallel_for_chunk;
 
-    while (pool->threads_running) {
-        task = NULL;
-        pthread_mutex_lock(&pool->tasks_mutex);
+void threadpool_push_task(threadpool *pool, void (*f)(void *), void *arg,
+                          task_group *group) {
+    threadpool_task *task = malloc(sizeof(threadpool_task));
+    task->task = f;
+    task->arg = arg;
+    task->group = group;
 
-        // Wait for and acquire a task
-        if (pool->tasks.size == 0) {
-            pthread_cond_signal(&pool->tasks_exhausted_cond);
-            pthread_cond_wait(&pool->tasks_available_cond, &pool->tasks_mutex);
-        }
-        task = vector_pop(&pool->tasks);
+    pthread_mutex_lock(&pool->tasks_mutex);
+    if (group != NULL)
+        group->pending++;
+    vector_push(&pool->tasks, task);
+    pthread_cond_signal(&pool->tasks_available_cond);
+    pthread_mutex_unlock(&pool->tasks_mutex);
+}
 
-        pthread_mutex_unlock(&pool->tasks_mutex);
+// Runs a task popped from the queue. Called and returns with the mutex held.
+void threadpool_run_task(threadpool *pool, threadpool_task *task) {
+    pool->tasks_running++;
+    pthread_mutex_unlock(&pool->tasks_mutex);
+
+    task->task(task->arg);
+
+    pthread_mutex_lock(&pool->tasks_mutex);
+    pool->tasks_running--;
+    if (task->group != NULL && --task->group->pending == 0)
+        pthread_cond_broadcast(&pool->group_finished_cond);
+    free(task);
+
+    // Wake up waiters once the queue is drained and no task is in flight
+    if (pool->tasks.size == 0 && pool->tasks_running == 0)
+        pthread_cond_broadcast(&pool->tasks_exhausted_cond);
+}
+
+void parallel_for_task(void *arg) {
+    parallel_for_chunk *chunk = arg;
+    chunk->f(chunk->ctx, chunk->begin, chunk->end);
+}
 
-        // Execute acquired task
-        if (task != NULL) {
-            task->task(task->arg);
-            free(task);
-        }
+void *threadpool_task_function(void *arg) {
+    threadpool *pool = (threadpool *)arg;
+
+    pthread_mutex_lock(&pool->tasks_mutex);
+    while (true) {
+        // Wait for and execute a task
+        while (pool->tasks.size == 0 && pool->threads_running)
+            pthread_cond_wait(&pool->tasks_available_cond, &pool->tasks_mutex);
+        if (!pool->threads_running)
+            break;
+        threadpool_run_task(pool, vector_pop(&pool->tasks));
     }
+    pthread_mutex_unlock(&pool->tasks_mutex);
 
     return NULL;
 }
@@ -47,6 +84,8 @@ void threadpool_init(threadpool *pool, size_t num_threads) {
     pthread_mutex_init(&pool->tasks_mutex, NULL);
     pthread_cond_init(&pool->tasks_available_cond, NULL);
     pthread_cond_init(&pool->tasks_exhausted_cond, NULL);
+    pthread_cond_init(&pool->group_finished_cond, NULL);
+    pool->tasks_running = 0;
     pool->threads_running = true;
 
     // Create and initialize threads
@@ -59,8 +98,10 @@ void threadpool_init(threadpool *pool, size_t num_threads) {
 
 void threadpool_destroy(threadpool *pool) {
     // Free threads
+    pthread_mutex_lock(&pool->tasks_mutex);
     pool->threads_running = false;
-    pthread_cond_signal(&pool->tasks_available_cond); // LIE to the threads!
+    pthread_cond_broadcast(&pool->tasks_available_cond); // LIE to the threads!
+    pthread_mutex_unlock(&pool->tasks_mutex);
     for (int i = 0; i < pool->threads.size; i++) {
         pthread_t *thread = pool->threads.data[i];
         pthread_join(*thread, NULL);
@@ -79,23 +120,77 @@ void threadpool_destroy(threadpool *pool) {
     pthread_mutex_destroy(&pool->tasks_mutex);
     pthread_cond_destroy(&pool->tasks_available_cond);
     pthread_cond_destroy(&pool->tasks_exhausted_cond);
+    pthread_cond_destroy(&pool->group_finished_cond);
 }
 
 void threadpool_add_task(threadpool *pool, void (*f)(void *), void *arg) {
-    // Create a task
-    threadpool_task *task = malloc(sizeof(threadpool_task));
-    task->task = f;
-    task->arg = arg;
+    threadpool_push_task(pool, f, arg, NULL);
+}
 
-    // Send created task to queue
+void threadpool_wait_for_tasks(threadpool *pool) {
     pthread_mutex_lock(&pool->tasks_mutex);
-    vector_push(&pool->tasks, task);
-    pthread_cond_signal(&pool->tasks_available_cond);
+    while (pool->tasks.size > 0 || pool->tasks_running > 0)
+        pthread_cond_wait(&pool->tasks_exhausted_cond, &pool->tasks_mutex);
     pthread_mutex_unlock(&pool->tasks_mutex);
 }
 
-void threadpool_wait_for_tasks(threadpool *pool) {
+void task_group_init(task_group *group, threadpool *pool) {
+    group->pool = pool;
+    group->pending = 0;
+}
+
+void task_group_add(task_group *group, void (*f)(void *), void *arg) {
+    threadpool_push_task(group->pool, f, arg, group);
+}
+
+void task_group_wait(task_group *group) {
+    threadpool *pool = group->pool;
+
     pthread_mutex_lock(&pool->tasks_mutex);
-    pthread_cond_wait(&pool->tasks_exhausted_cond, &pool->tasks_mutex);
+    while (group->pending > 0) {
+        // Help out instead of blocking a worker that nested tasks may need
+        if (pool->tasks.size > 0)
+            threadpool_run_task(pool, vector_pop(&pool->tasks));
+        else
+            pthread_cond_wait(&pool->group_finished_cond, &pool->tasks_mutex);
+    }
     pthread_mutex_unlock(&pool->tasks_mutex);
 }
+
+void parallel_for(threadpool *pool, size_t begin, size_t end, size_t grain,
+                  void (*f)(void *ctx, size_t begin, size_t end), void *ctx) {
+    if (begin >= end)
+        return;
+    if (pool == NULL) {
+        f(ctx, begin, end);
+        return;
+    }
+
+    size_t count = end - begin;
+    if (grain == 0) {
+        size_t num_threads = pool->threads.size > 0 ? pool->threads.size : 1;
+        size_t num_chunks = num_threads * PARALLEL_FOR_CHUNKS_PER_THREAD;
+        grain = (count + num_chunks - 1) / num_chunks;
+    }
+
+    // Not worth a trip through the queue
+    size_t num_chunks = (count + grain - 1) / grain;
+    if (num_chunks == 1) {
+        f(ctx, begin, end);
+        return;
+    }
+
+    parallel_for_chunk *chunks =
+        malloc(num_chunks * sizeof(parallel_for_chunk));
+    task_group group;
+    task_group_init(&group, pool);
+    for (size_t i = 0; i < num_chunks; i++) {
+        size_t first = begin + i * grain;
+        size_t last = end - first > grain ? first + grain : end;
+        chunks[i] = (parallel_for_chunk){f, ctx, first, last};
+        task_group_add(&group, parallel_for_task, &chunks[i]);
+    }
+
+    task_group_wait(&group);
+    free(chunks);
+}
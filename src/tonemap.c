@@ -0,0 +1,299 @@
+#include "tonemap.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TONEMAP_NOISE_PIXELS (TONEMAP_NOISE_SIZE * TONEMAP_NOISE_SIZE)
+#define TONEMAP_NOISE_SIGMA 1.5f // Spread of the void-and-cluster filter
+#define TONEMAP_NOISE_SEEDS (TONEMAP_NOISE_PIXELS / 10)
+// One noise row for each channel of TONEMAP_NOISE_SIZE pixels, a whole
+// number of SIMD vectors so rows can be walked four floats at a time
+#define TONEMAP_DITHER_PERIOD (3 * TONEMAP_NOISE_SIZE)
+
+// Ranks of the void-and-cluster pattern, scaled into [0, 1)
+float tonemap_noise[TONEMAP_NOISE_PIXELS];
+pthread_once_t tonemap_noise_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+    const framebuffer *fb;
+    const framebuffer_region *region;
+    const tonemap_settings *settings;
+    uint8_t *pixels;
+} tonemap_args;
+
+// --- Private ---
+
+// Energy of every pixel from a point at index, filtered on the torus
+void tonemap_splat(float *energy, const float *kernel, size_t index,
+                   float sign) {
+    size_t px = index % TONEMAP_NOISE_SIZE, py = index / TONEMAP_NOISE_SIZE;
+    for (size_t y = 0; y < TONEMAP_NOISE_SIZE; y++) {
+        size_t dy = (y - py) & (TONEMAP_NOISE_SIZE - 1);
+        for (size_t x = 0; x < TONEMAP_NOISE_SIZE; x++) {
+            size_t dx = (x - px) & (TONEMAP_NOISE_SIZE - 1);
+            energy[y * TONEMAP_NOISE_SIZE + x] +=
+                sign * kernel[dy * TONEMAP_NOISE_SIZE + dx];
+        }
+    }
+}
+
+// Most crowded set pixel, or emptiest unset one
+size_t tonemap_extreme(const float *energy, const bool *set, bool want_set) {
+    size_t best = 0;
+    float best_energy = want_set ? -INFINITY : INFINITY;
+    for (size_t i = 0; i < TONEMAP_NOISE_PIXELS; i++) {
+        if (set[i] != want_set)
+            continue;
+        if (want_set ? energy[i] > best_energy : energy[i] < best_energy) {
+            best = i;
+            best_energy = energy[i];
+        }
+    }
+    return best;
+}
+
+// Void-and-cluster (Ulichney 1993), deterministic so images are repeatable
+void tonemap_build_noise() {
+    float kernel[TONEMAP_NOISE_PIXELS];
+    for (size_t y = 0; y < TONEMAP_NOISE_SIZE; y++) {
+        for (size_t x = 0; x < TONEMAP_NOISE_SIZE; x++) {
+            float dx = fminf(x, TONEMAP_NOISE_SIZE - x);
+            float dy = fminf(y, TONEMAP_NOISE_SIZE - y);
+            kernel[y * TONEMAP_NOISE_SIZE + x] = expf(
+                -(dx * dx + dy * dy) /
+                (2 * TONEMAP_NOISE_SIGMA * TONEMAP_NOISE_SIGMA));
+        }
+    }
+
+    // Random seed points, then swap the tightest cluster into the largest
+    // void until that stops moving anything
+    bool seeds[TONEMAP_NOISE_PIXELS] = {0};
+    float seed_energy[TONEMAP_NOISE_PIXELS] = {0};
+    uint32_t state = 0x9e3779b9;
+    for (size_t placed = 0; placed < TONEMAP_NOISE_SEEDS;) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        size_t i = state % TONEMAP_NOISE_PIXELS;
+        if (seeds[i])
+            continue;
+        seeds[i] = true;
+        tonemap_splat(seed_energy, kernel, i, 1);
+        placed++;
+    }
+    for (;;) {
+        size_t cluster = tonemap_extreme(seed_energy, seeds, true);
+        seeds[cluster] = false;
+        tonemap_splat(seed_energy, kernel, cluster, -1);
+
+        size_t hole = tonemap_extreme(seed_energy, seeds, false);
+        seeds[hole] = true;
+        tonemap_splat(seed_energy, kernel, hole, 1);
+        if (hole == cluster)
+            break;
+    }
+
+    // Seeds are ranked by removing clusters, the rest by filling voids
+    bool set[TONEMAP_NOISE_PIXELS];
+    float energy[TONEMAP_NOISE_PIXELS];
+    memcpy(set, seeds, sizeof(set));
+    memcpy(energy, seed_energy, sizeof(energy));
+    for (size_t rank = TONEMAP_NOISE_SEEDS; rank-- > 0;) {
+        size_t cluster = tonemap_extreme(energy, set, true);
+        set[cluster] = false;
+        tonemap_splat(energy, kernel, cluster, -1);
+        tonemap_noise[cluster] = (rank + 0.5f) / TONEMAP_NOISE_PIXELS;
+    }
+
+    memcpy(set, seeds, sizeof(set));
+    memcpy(energy, seed_energy, sizeof(energy));
+    for (size_t rank = TONEMAP_NOISE_SEEDS; rank < TONEMAP_NOISE_PIXELS;
+         rank++) {
+        size_t hole = tonemap_extreme(energy, set, false);
+        set[hole] = true;
+        tonemap_splat(energy, kernel, hole, 1);
+        tonemap_noise[hole] = (rank + 0.5f) / TONEMAP_NOISE_PIXELS;
+    }
+}
+
+// Per channel offsets into the noise so the channels dither independently
+size_t tonemap_noise_index(size_t x, size_t y, size_t channel) {
+    return ((y + 7 * channel) % TONEMAP_NOISE_SIZE) * TONEMAP_NOISE_SIZE +
+           (x + 11 * channel) % TONEMAP_NOISE_SIZE;
+}
+
+// Added before truncation, so 0.5 everywhere rounds to nearest. Starts at
+// column x0, so a crop gets the same values as the whole frame.
+void tonemap_dither_row(const tonemap_settings *settings, size_t x0,
+                        size_t y, float *dither) {
+    for (size_t x = 0; x < TONEMAP_NOISE_SIZE; x++)
+        for (size_t c = 0; c < 3; c++)
+            dither[3 * x + c] =
+                settings->dither
+                    ? tonemap_noise[tonemap_noise_index(x0 + x, y, c)]
+                    : 0.5f;
+}
+
+float tonemap_curve(float v, tonemap_operator op) {
+    switch (op) {
+    case TONEMAP_REINHARD:
+        return v / (1 + v);
+    case TONEMAP_ACES:
+        return v * (2.51f * v + 0.03f) / (v * (2.43f * v + 0.59f) + 0.14f);
+    default:
+        return v;
+    }
+}
+
+// x^(1/2.4) from three square roots, within a fraction of an 8 bit step
+float tonemap_srgb(float v) {
+    if (v <= 0.0031308f)
+        return 12.92f * v;
+    float s1 = sqrtf(v), s2 = sqrtf(s1), s3 = sqrtf(s2);
+    return 0.585122381f * s1 + 0.783140355f * s2 - 0.368262736f * s3;
+}
+
+// Linear value, already exposed, to its 8 bit code
+uint8_t tonemap_encode(float v, tonemap_operator op, float dither) {
+    v = tonemap_curve(fmaxf(v, 0), op);
+    v = tonemap_srgb(fminf(v, 1));
+    return fminf(v * 255 + dither, 255);
+}
+
+#ifdef __SSE2__
+__m128 tonemap_curve4(__m128 v, tonemap_operator op) {
+    __m128 one = _mm_set1_ps(1);
+    switch (op) {
+    case TONEMAP_REINHARD:
+        return _mm_div_ps(v, _mm_add_ps(one, v));
+    case TONEMAP_ACES: {
+        __m128 num = _mm_mul_ps(
+            v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), v),
+                          _mm_set1_ps(0.03f)));
+        __m128 den = _mm_add_ps(
+            _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), v),
+                                     _mm_set1_ps(0.59f))),
+            _mm_set1_ps(0.14f));
+        return _mm_div_ps(num, den);
+    }
+    default:
+        return v;
+    }
+}
+
+__m128 tonemap_srgb4(__m128 v) {
+    __m128 s1 = _mm_sqrt_ps(v), s2 = _mm_sqrt_ps(s1), s3 = _mm_sqrt_ps(s2);
+    __m128 curve = _mm_sub_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.585122381f), s1),
+                   _mm_mul_ps(_mm_set1_ps(0.783140355f), s2)),
+        _mm_mul_ps(_mm_set1_ps(0.368262736f), s3));
+    __m128 linear = _mm_mul_ps(_mm_set1_ps(12.92f), v);
+    __m128 toe = _mm_cmple_ps(v, _mm_set1_ps(0.0031308f));
+    return _mm_or_ps(_mm_and_ps(toe, linear), _mm_andnot_ps(toe, curve));
+}
+
+// Same steps as tonemap_encode on four values, the max against 0 comes
+// first so NaN turns into 0 as well
+__m128i tonemap_encode4(__m128 v, tonemap_operator op, __m128 dither) {
+    v = tonemap_curve4(_mm_max_ps(v, _mm_setzero_ps()), op);
+    v = tonemap_srgb4(_mm_min_ps(v, _mm_set1_ps(1)));
+    v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255)), dither);
+    return _mm_cvttps_epi32(_mm_min_ps(v, _mm_set1_ps(255)));
+}
+#endif
+
+// Encodes one row of interleaved RGB floats
+void tonemap_row(const tonemap_settings *settings, const float *linear,
+                 const float *dither, size_t count, uint8_t *out) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // Sixteen values per step, packed down to bytes with saturation
+    for (; i + 16 <= count; i += 16) {
+        __m128i q[4];
+        for (size_t k = 0; k < 4; k++) {
+            size_t at = i + 4 * k;
+            q[k] = tonemap_encode4(
+                _mm_loadu_ps(&linear[at]), settings->op,
+                _mm_loadu_ps(&dither[at % TONEMAP_DITHER_PERIOD]));
+        }
+        __m128i words = _mm_packs_epi32(q[0], q[1]);
+        __m128i words_hi = _mm_packs_epi32(q[2], q[3]);
+        _mm_storeu_si128((__m128i *)&out[i],
+                         _mm_packus_epi16(words, words_hi));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = tonemap_encode(linear[i], settings->op,
+                                dither[i % TONEMAP_DITHER_PERIOD]);
+}
+
+// Rows [begin, end) of the region, counted from its top
+void tonemap_rows(void *ctx, size_t begin, size_t end) {
+    tonemap_args *args = ctx;
+    const framebuffer *fb = args->fb;
+    const framebuffer_region *region = args->region;
+    size_t width = region->x1 - region->x0;
+    float scale = exp2f(args->settings->exposure);
+
+    float *linear = malloc(3 * width * sizeof(float));
+    float dither[TONEMAP_DITHER_PERIOD];
+    for (size_t row = begin; row < end; row++) {
+        // Same as framebuffer_get, with the exposure folded into the mean
+        size_t y = region->y0 + row;
+        for (size_t x = 0; x < width; x++) {
+            size_t idx = y * fb->width + region->x0 + x;
+            uint32_t samples = fb->samples[idx];
+            vec3s color = samples > 0 ? fb->color[idx] : fb->preview[idx];
+            float weight = samples > 0 ? scale / samples : scale;
+            for (size_t c = 0; c < 3; c++)
+                linear[3 * x + c] = color.raw[c] * weight;
+        }
+
+        tonemap_dither_row(args->settings, region->x0, y, dither);
+        tonemap_row(args->settings, linear, dither, 3 * width,
+                    &args->pixels[3 * row * width]);
+    }
+    free(linear);
+}
+
+// --- Public ---
+
+tonemap_settings tonemap_default() {
+    return (tonemap_settings){
+        .exposure = 0,
+        .op = TONEMAP_ACES,
+        .dither = true,
+    };
+}
+
+void tonemap_pixel(const tonemap_settings *settings, const vec3s color,
+                   size_t x, size_t y, uint8_t *rgb) {
+    pthread_once(&tonemap_noise_once, tonemap_build_noise);
+    float scale = exp2f(settings->exposure);
+    for (size_t c = 0; c < 3; c++) {
+        float dither = settings->dither
+                           ? tonemap_noise[tonemap_noise_index(x, y, c)]
+                           : 0.5f;
+        rgb[c] = tonemap_encode(color.raw[c] * scale, settings->op, dither);
+    }
+}
+
+void tonemap(threadpool *pool, const framebuffer *fb,
+             const tonemap_settings *settings, uint8_t *pixels) {
+    framebuffer_region full = {0, 0, fb->width, fb->height};
+    tonemap_region(pool, fb, &full, settings, pixels);
+}
+
+void tonemap_region(threadpool *pool, const framebuffer *fb,
+                    const framebuffer_region *region,
+                    const tonemap_settings *settings, uint8_t *pixels) {
+    pthread_once(&tonemap_noise_once, tonemap_build_noise);
+
+    tonemap_args args = {fb, region, settings, pixels};
+    parallel_for(pool, 0, region->y1 - region->y0, 0, tonemap_rows, &args);
+}
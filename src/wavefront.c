@@ -0,0 +1,377 @@
+#include "wavefront.h"
+#include "ray.h"
+#include "renderer.h"
+#include <cglm/struct.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CELL_BITS 5
+#define SORT_KEY_BITS (3 * CELL_BITS + 3)
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define NO_RECORD UINT32_MAX
+
+typedef struct {
+    vec3s origin;
+    vec3s direction;
+    vec3s throughput; // Product of albedos and weights along the path
+    uint32_t pixel;   // Index into the tile's radiance array
+    uint32_t depth;
+    uint64_t rand_state; // The path's own stream, see rand_save
+    bool count_emission; // False after a light sample at the previous hit
+
+    // Innermost guided bounce the path went through, and the throughput
+    // gathered since that bounce's ray left the surface
+    uint32_t record;
+    vec3s record_throughput;
+} wavefront_ray;
+
+// Guided bounce waiting for the radiance its ray brings back. Paths finish
+// generations later, so contributions are credited as they arrive.
+typedef struct {
+    vec3s point;
+    vec3s direction;
+    vec3s radiance;
+    float guide_weight;
+    uint32_t parent;          // Enclosing guided bounce, NO_RECORD if none
+    vec3s parent_throughput;  // From the parent's ray to this one's
+} guide_record;
+
+typedef struct {
+    wavefront_ray *rays;
+    size_t size;
+    size_t capacity;
+} ray_queue;
+
+typedef struct {
+    guide_record *records;
+    size_t size;
+    size_t capacity;
+} record_list;
+
+typedef struct {
+    vec3s min;
+    vec3s inv_extent;
+} sort_grid;
+
+// --- Private ---
+
+void ray_queue_init(ray_queue *q, size_t capacity) {
+    q->capacity = capacity;
+    q->size = 0;
+    q->rays = malloc(q->capacity * sizeof(wavefront_ray));
+}
+
+void ray_queue_reserve(ray_queue *q, size_t capacity) {
+    if (q->capacity >= capacity)
+        return;
+    q->capacity = capacity;
+    q->rays = realloc(q->rays, q->capacity * sizeof(wavefront_ray));
+}
+
+void ray_queue_push(ray_queue *q, const wavefront_ray *ray) {
+    if (q->size == q->capacity)
+        ray_queue_reserve(q, q->capacity * 2);
+    q->rays[q->size++] = *ray;
+}
+
+void ray_queue_destroy(ray_queue *q) { free(q->rays); }
+
+uint32_t record_list_push(record_list *l, const guide_record *record) {
+    if (l->size == l->capacity) {
+        l->capacity = l->capacity > 0 ? l->capacity * 2 : 64;
+        l->records = realloc(l->records, l->capacity * sizeof(guide_record));
+    }
+    l->records[l->size] = *record;
+    return l->size++;
+}
+
+// Radiance leaving toward the ray reaches the pixel and every guided bounce
+// the path went through, weighted as incident_light would return it there
+void add_radiance(vec3s *radiance, record_list *l, const wavefront_ray *ray,
+                  const vec3s value) {
+    radiance[ray->pixel] = glms_vec3_add(radiance[ray->pixel],
+                                         glms_vec3_mul(ray->throughput, value));
+
+    vec3s incident = glms_vec3_mul(ray->record_throughput, value);
+    for (uint32_t r = ray->record; r != NO_RECORD; r = l->records[r].parent) {
+        guide_record *record = &l->records[r];
+        record->radiance =
+            glms_vec3_add(record->radiance,
+                          glms_vec3_scale(incident, record->guide_weight));
+        incident = glms_vec3_mul(incident, record->parent_throughput);
+    }
+}
+
+// Spread the low 10 bits of v so that there are two zero bits between each
+uint32_t morton_spread(uint32_t v) {
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Rays in the same grid cell travelling into the same octant sort together
+uint32_t ray_sort_key(const wavefront_ray *ray, const sort_grid *grid) {
+    uint32_t cell[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float t = (ray->origin.raw[axis] - grid->min.raw[axis]) *
+                  grid->inv_extent.raw[axis];
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        cell[axis] = (uint32_t)(t * ((1 << CELL_BITS) - 1));
+    }
+    uint32_t morton = morton_spread(cell[0]) | morton_spread(cell[1]) << 1 |
+                      morton_spread(cell[2]) << 2;
+
+    uint32_t octant = (ray->direction.x < 0) | (ray->direction.y < 0) << 1 |
+                      (ray->direction.z < 0) << 2;
+
+    return morton << 3 | octant;
+}
+
+// LSD radix sort of indices by key, keys and indices are sorted in place
+void radix_sort(uint32_t *keys, uint32_t *indices, uint32_t *tmp_keys,
+                uint32_t *tmp_indices, size_t n, int key_bits) {
+    for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+        size_t offsets[RADIX_BUCKETS] = {0};
+        for (size_t i = 0; i < n; i++)
+            offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+
+        size_t total = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            size_t count = offsets[b];
+            offsets[b] = total;
+            total += count;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            size_t dst = offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            tmp_keys[dst] = keys[i];
+            tmp_indices[dst] = indices[i];
+        }
+
+        memcpy(keys, tmp_keys, n * sizeof(uint32_t));
+        memcpy(indices, tmp_indices, n * sizeof(uint32_t));
+    }
+}
+
+// --- Public ---
+
+void wavefront_render_tile(const scene *world, const camera *cam,
+                           framebuffer *fb, guiding *guide, uint64_t seed,
+                           size_t x0, size_t y0, size_t x1, size_t y1) {
+    size_t tile_w = x1 - x0;
+    size_t tile_h = y1 - y0;
+    size_t num_pixels = tile_w * tile_h;
+    float aspect_ratio = (float)fb->width / (float)fb->height;
+
+    sort_grid grid;
+    vec3s max;
+    scene_bounds(world, &grid.min, &max);
+    vec3s extent = glms_vec3_sub(max, grid.min);
+    grid.inv_extent = glms_vec3_div(
+        glms_vec3_one(), glms_vec3_maxv(extent, glms_vec3_broadcast(1e-6)));
+
+    vec3s *radiance = calloc(num_pixels, sizeof(vec3s));
+    record_list records = {0};
+
+    ray_queue current, next, sorted;
+    ray_queue_init(&current, num_pixels);
+    ray_queue_init(&next, num_pixels);
+    ray_queue_init(&sorted, num_pixels);
+
+    size_t scratch_capacity = 0;
+    ray_hit *hits = NULL;
+    uint32_t *keys = NULL, *indices = NULL, *tmp_keys = NULL,
+             *tmp_indices = NULL;
+    size_t *material_offsets =
+        malloc((world->num_materials + 1) * sizeof(size_t));
+
+    // Generate camera rays for the whole tile
+    for (size_t py = 0; py < tile_h; py++) {
+        float y = -((float)(y0 + py) / fb->height * 2.0f - 1.0f);
+        for (size_t px = 0; px < tile_w; px++) {
+            float x = ((float)(x0 + px) / fb->width * 2.0f - 1.0f);
+            size_t idx = (y0 + py) * fb->width + x0 + px;
+            rand_seed(seed, idx, fb->samples[idx]);
+            wavefront_ray ray = {
+                .origin = cam->position,
+                .direction = primary_direction(cam, x, y, aspect_ratio),
+                .throughput = glms_vec3_one(),
+                .pixel = py * tile_w + px,
+                .depth = 0,
+                .rand_state = rand_save(),
+                .count_emission = true,
+                .record = NO_RECORD,
+                .record_throughput = glms_vec3_one(),
+            };
+            ray_queue_push(&current, &ray);
+        }
+    }
+
+    while (current.size > 0) {
+        size_t n = current.size;
+        if (n > scratch_capacity) {
+            scratch_capacity = n;
+            hits = realloc(hits, n * sizeof(ray_hit));
+            keys = realloc(keys, n * sizeof(uint32_t));
+            indices = realloc(indices, n * sizeof(uint32_t));
+            tmp_keys = realloc(tmp_keys, n * sizeof(uint32_t));
+            tmp_indices = realloc(tmp_indices, n * sizeof(uint32_t));
+        }
+
+        // Bin rays by origin cell and direction octant before tracing
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = ray_sort_key(&current.rays[i], &grid);
+            indices[i] = i;
+        }
+        radix_sort(keys, indices, tmp_keys, tmp_indices, n, SORT_KEY_BITS);
+
+        ray_queue_reserve(&sorted, n);
+        for (size_t i = 0; i < n; i++)
+            sorted.rays[i] = current.rays[indices[i]];
+        sorted.size = n;
+
+        // Trace the whole batch, rays past the bounce limit see the sky
+        for (size_t i = 0; i < n; i++) {
+            const wavefront_ray *ray = &sorted.rays[i];
+            if (ray->depth > MAX_BOUNCES)
+                hits[i].distance = -1;
+            else
+                hits[i] = trace_ray(ray->origin, ray->direction, world);
+        }
+
+        // Bin hits by material so shading touches one material at a time
+        memset(material_offsets, 0,
+               (world->num_materials + 1) * sizeof(size_t));
+        size_t num_hits = 0;
+        for (size_t i = 0; i < n; i++) {
+            const wavefront_ray *ray = &sorted.rays[i];
+            if (hits[i].distance < 0) {
+                add_radiance(radiance, &records, ray, world->sky_color);
+                continue;
+            }
+            material_offsets[hits[i].material + 1]++;
+            num_hits++;
+        }
+        for (size_t m = 0; m < world->num_materials; m++)
+            material_offsets[m + 1] += material_offsets[m];
+        for (size_t i = 0; i < n; i++)
+            if (hits[i].distance >= 0)
+                indices[material_offsets[hits[i].material]++] = i;
+
+        // Shade and queue the next generation of rays
+        next.size = 0;
+        for (size_t j = 0; j < num_hits; j++) {
+            const wavefront_ray *ray = &sorted.rays[indices[j]];
+            const ray_hit *hit = &hits[indices[j]];
+            const hot_material *mat = &world->hot_materials[hit->material];
+
+            // Surface emission, skipped when the previous hit sampled it
+            // directly
+            if (ray->count_emission)
+                add_radiance(radiance, &records, ray, mat->emission);
+
+            // Sorting reorders rays, so each carries its stream along
+            rand_restore(ray->rand_state);
+
+            // Direct light as in shade_hit, its shadow ray is traced right
+            // away rather than queued
+            bool diffuse = mat->roughness >= DIFFUSE_ROUGHNESS;
+            bool sample_lights = world->lights.num_nodes > 0 && diffuse &&
+                                 mat->transparency < 1.0;
+            if (sample_lights) {
+                vec3s direct = glms_vec3_scale(sample_direct_light(hit, world),
+                                               1.0 - mat->transparency);
+                add_radiance(radiance, &records, ray,
+                             glms_vec3_mul(direct, mat->albedo));
+            }
+
+            scattered_ray scattered[2];
+            size_t num_scattered =
+                scatter_rays(ray->direction, hit, mat, scattered);
+
+            for (size_t k = 0; k < num_scattered; k++) {
+                bool guided_bounce =
+                    guide != NULL && diffuse && scattered[k].reflected;
+
+                // Once fitted, the guide picks diffuse bounces instead
+                float guide_weight = 1;
+                if (guided_bounce && guide->ready) {
+                    guide_weight = guiding_sample(
+                        guide, hit->point, hit->normal, rand_float(),
+                        rand_float(), rand_float(), &scattered[k].direction);
+                    if (guide_weight == 0)
+                        continue;
+                    scattered[k].origin = glms_vec3_add(
+                        hit->point,
+                        glms_vec3_scale(scattered[k].direction, 0.001));
+                    scattered[k].weight *= guide_weight;
+                }
+
+                // Branches of a path continue on separate streams
+                uint64_t state = rand_next();
+                state = state << 32 | rand_next();
+                vec3s step =
+                    glms_vec3_scale(mat->albedo, scattered[k].weight);
+                wavefront_ray child = {
+                    .origin = scattered[k].origin,
+                    .direction = scattered[k].direction,
+                    .throughput = glms_vec3_mul(ray->throughput, step),
+                    .pixel = ray->pixel,
+                    .depth = ray->depth + 1,
+                    .rand_state = state,
+                    .count_emission =
+                        !(sample_lights && scattered[k].reflected),
+                    .record = ray->record,
+                    .record_throughput =
+                        glms_vec3_mul(ray->record_throughput, step),
+                };
+
+                // Guided bounces record what their ray brings back
+                if (guided_bounce) {
+                    guide_record record = {
+                        .point = hit->point,
+                        .direction = scattered[k].direction,
+                        .radiance = glms_vec3_zero(),
+                        .guide_weight = guide_weight,
+                        .parent = ray->record,
+                        .parent_throughput = child.record_throughput,
+                    };
+                    child.record = record_list_push(&records, &record);
+                    child.record_throughput = glms_vec3_one();
+                }
+                ray_queue_push(&next, &child);
+            }
+        }
+
+        ray_queue tmp = current;
+        current = next;
+        next = tmp;
+    }
+
+    for (size_t py = 0; py < tile_h; py++)
+        for (size_t px = 0; px < tile_w; px++)
+            framebuffer_add_sample(fb, x0 + px, y0 + py,
+                                   radiance[py * tile_w + px]);
+
+    for (size_t r = 0; r < records.size; r++)
+        guiding_record(guide, records.records[r].point,
+                       records.records[r].direction,
+                       records.records[r].radiance);
+
+    free(radiance);
+    free(records.records);
+    free(hits);
+    free(keys);
+    free(indices);
+    free(tmp_keys);
+    free(tmp_indices);
+    free(material_offsets);
+    ray_queue_destroy(&current);
+    ray_queue_destroy(&next);
+    ray_queue_destroy(&sorted);
+}
@@ -0,0 +1,223 @@
+#include "wide_bvh.h"
+#include "shapes.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE_BVH_MIN_EXPONENT -126
+#define WIDE_BVH_MAX_EXPONENT 127
+
+// --- Private ---
+
+float wide_bvh_half_area(const bvh_node *node) {
+    vec3s extent = glms_vec3_sub(node->max, node->min);
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+int wide_bvh_clamp(int value, int min, int max) {
+    return value < min ? min : value > max ? max : value;
+}
+
+// 2^exponent, built from the float bits since this runs for every node visit
+float wide_bvh_step(int8_t exponent) {
+    union {
+        uint32_t bits;
+        float value;
+    } step = {.bits = (uint32_t)(exponent + 127) << 23};
+    return step.value;
+}
+
+// Pull up to four descendants of a binary node into one wide node by
+// repeatedly opening the interior child with the largest surface area
+size_t wide_bvh_gather(const bvh *b, uint32_t node, uint32_t *children) {
+    if (b->nodes[node].count > 0) {
+        children[0] = node;
+        return 1;
+    }
+
+    children[0] = b->nodes[node].left_first;
+    children[1] = b->nodes[node].left_first + 1;
+    size_t count = 2;
+    while (count < WIDE_BVH_WIDTH) {
+        int best = -1;
+        float best_area = -1;
+        for (size_t i = 0; i < count; i++) {
+            const bvh_node *child = &b->nodes[children[i]];
+            if (child->count == 0 && wide_bvh_half_area(child) > best_area) {
+                best = i;
+                best_area = wide_bvh_half_area(child);
+            }
+        }
+        if (best < 0)
+            break;
+
+        uint32_t left = b->nodes[children[best]].left_first;
+        children[best] = left;
+        children[count++] = left + 1;
+    }
+    return count;
+}
+
+void wide_bvh_quantize(wide_bvh_node *node, const bvh *b,
+                       const uint32_t *children, size_t count) {
+    vec3s min = glms_vec3_broadcast(INFINITY);
+    vec3s max = glms_vec3_broadcast(-INFINITY);
+    for (size_t i = 0; i < count; i++) {
+        min = glms_vec3_minv(min, b->nodes[children[i]].min);
+        max = glms_vec3_maxv(max, b->nodes[children[i]].max);
+    }
+    node->origin = min;
+
+    for (int axis = 0; axis < 3; axis++) {
+        // Smallest power of two step spanning the node in 255 steps
+        float extent = max.raw[axis] - min.raw[axis];
+        int exponent = WIDE_BVH_MIN_EXPONENT;
+        if (extent > 0) {
+            frexpf(extent / 255, &exponent);
+            exponent = wide_bvh_clamp(exponent, WIDE_BVH_MIN_EXPONENT,
+                                      WIDE_BVH_MAX_EXPONENT);
+        }
+        while (exponent < WIDE_BVH_MAX_EXPONENT &&
+               min.raw[axis] + 255 * wide_bvh_step(exponent) < max.raw[axis])
+            exponent++;
+        node->exponent[axis] = exponent;
+
+        // Round outwards, then fix up float error in the decoded planes
+        float step = wide_bvh_step(exponent);
+        for (size_t i = 0; i < count; i++) {
+            float child_min = b->nodes[children[i]].min.raw[axis];
+            float child_max = b->nodes[children[i]].max.raw[axis];
+
+            float lo_steps = floorf((child_min - min.raw[axis]) / step);
+            float hi_steps = ceilf((child_max - min.raw[axis]) / step);
+            int lo = wide_bvh_clamp(fminf(lo_steps, 255), 0, 255);
+            int hi = wide_bvh_clamp(fmaxf(hi_steps, 0), 0, 255);
+            while (lo > 0 && min.raw[axis] + lo * step > child_min)
+                lo--;
+            while (hi < 255 && min.raw[axis] + hi * step < child_max)
+                hi++;
+
+            node->lo[axis][i] = lo;
+            node->hi[axis][i] = hi;
+        }
+    }
+}
+
+// --- Public ---
+
+void wide_bvh_init(wide_bvh *w) {
+    w->nodes = NULL;
+    w->num_nodes = 0;
+    w->indices = NULL;
+    w->num_indices = 0;
+}
+
+int wide_bvh_build(wide_bvh *w, const bvh *b) {
+    wide_bvh_destroy(w);
+    if (b->num_nodes == 0)
+        return 0;
+
+    // Each wide node stands in for at least one binary node
+    w->nodes = aligned_alloc(PRIMITIVE_ALIGNMENT,
+                             b->num_nodes * sizeof(wide_bvh_node));
+    w->indices = malloc(b->num_indices * sizeof(uint32_t));
+    memcpy(w->indices, b->indices, b->num_indices * sizeof(uint32_t));
+    w->num_indices = b->num_indices;
+
+    // Binary node each wide node was collapsed from, doubling as the
+    // breadth-first queue
+    uint32_t *sources = malloc(b->num_nodes * sizeof(uint32_t));
+    sources[0] = 0;
+    w->num_nodes = 1;
+
+    for (size_t i = 0; i < w->num_nodes; i++) {
+        uint32_t children[WIDE_BVH_WIDTH];
+        size_t count = wide_bvh_gather(b, sources[i], children);
+
+        wide_bvh_node *node = &w->nodes[i];
+        memset(node, 0, sizeof(wide_bvh_node));
+        wide_bvh_quantize(node, b, children, count);
+        node->num_children = count;
+
+        for (size_t c = 0; c < count; c++) {
+            const bvh_node *child = &b->nodes[children[c]];
+            if (child->count > UINT16_MAX) {
+                fprintf(stderr, "BVH leaf of %u primitives is too large\n",
+                        child->count);
+                free(sources);
+                wide_bvh_destroy(w);
+                return -1;
+            }
+
+            if (child->count > 0) {
+                node->child[c] = child->left_first;
+                node->count[c] = child->count;
+            } else {
+                node->child[c] = w->num_nodes;
+                sources[w->num_nodes++] = children[c];
+            }
+        }
+    }
+
+    free(sources);
+    return 0;
+}
+
+void wide_bvh_destroy(wide_bvh *w) {
+    free(w->nodes);
+    free(w->indices);
+    wide_bvh_init(w);
+}
+
+void wide_bvh_bounds(const wide_bvh *w, vec3s *min, vec3s *max) {
+    *min = glms_vec3_broadcast(INFINITY);
+    *max = glms_vec3_broadcast(-INFINITY);
+    if (w->num_nodes == 0)
+        return;
+
+    const wide_bvh_node *root = &w->nodes[0];
+    for (int axis = 0; axis < 3; axis++) {
+        float step = wide_bvh_step(root->exponent[axis]);
+        for (size_t i = 0; i < root->num_children; i++) {
+            min->raw[axis] =
+                fminf(min->raw[axis],
+                      root->origin.raw[axis] + root->lo[axis][i] * step);
+            max->raw[axis] =
+                fmaxf(max->raw[axis],
+                      root->origin.raw[axis] + root->hi[axis][i] * step);
+        }
+    }
+}
+
+uint32_t wide_bvh_intersect_node(const wide_bvh_node *node,
+                                 const vec3s origin, const vec3s inv_direction,
+                                 float max_distance, float *entry_distances) {
+    // Planes relative to the ray origin, shared by all children
+    float step[3], base[3];
+    for (int axis = 0; axis < 3; axis++) {
+        step[axis] = wide_bvh_step(node->exponent[axis]);
+        base[axis] = node->origin.raw[axis] - origin.raw[axis];
+    }
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < node->num_children; i++) {
+        // Slab test against the decoded child box
+        float t_min = 0, t_max = max_distance;
+        for (int axis = 0; axis < 3; axis++) {
+            float t1 = (base[axis] + node->lo[axis][i] * step[axis]) *
+                       inv_direction.raw[axis];
+            float t2 = (base[axis] + node->hi[axis][i] * step[axis]) *
+                       inv_direction.raw[axis];
+            t_min = fmaxf(t_min, fminf(t1, t2));
+            t_max = fminf(t_max, fmaxf(t1, t2));
+        }
+
+        if (t_min <= t_max) {
+            mask |= 1u << i;
+            entry_distances[i] = t_min;
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,136 @@
+#include "gpu/scene_buffer.h"
+#include <cglm/struct.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+int failures = 0;
+
+// --- Private ---
+
+int32_t texel_int(const scene_buffer *buf, size_t texel, size_t component) {
+    int32_t value;
+    memcpy(&value,
+           buf->data + texel * SCENE_BUFFER_TEXEL_SIZE +
+               component * sizeof(int32_t),
+           sizeof(value));
+    return value;
+}
+
+float texel_float(const scene_buffer *buf, size_t texel, size_t component) {
+    float value;
+    memcpy(&value,
+           buf->data + texel * SCENE_BUFFER_TEXEL_SIZE +
+               component * sizeof(float),
+           sizeof(value));
+    return value;
+}
+
+void test_layout(const scene_buffer *buf) {
+    size_t material_offset = SCENE_BUFFER_HEADER_TEXELS;
+    size_t sphere_offset = material_offset + 2 * SCENE_BUFFER_MATERIAL_TEXELS;
+    size_t triangle_offset = sphere_offset + 2 * SCENE_BUFFER_SPHERE_TEXELS;
+    size_t num_texels = triangle_offset + SCENE_BUFFER_TRIANGLE_TEXELS;
+
+    CHECK(buf->size == num_texels * SCENE_BUFFER_TEXEL_SIZE);
+    CHECK(texel_int(buf, 0, 0) == 2);
+    CHECK(texel_int(buf, 0, 1) == 2);
+    CHECK(texel_int(buf, 0, 2) == 1);
+    CHECK(texel_int(buf, 1, 0) == material_offset);
+    CHECK(texel_int(buf, 1, 1) == sphere_offset);
+    CHECK(texel_int(buf, 1, 2) == triangle_offset);
+
+    size_t mat = material_offset + SCENE_BUFFER_MATERIAL_TEXELS;
+    CHECK(texel_float(buf, mat, 0) == 0.25f);
+    CHECK(texel_float(buf, mat, 3) == 0.5f);
+    CHECK(texel_float(buf, mat + 1, 3) == 4.0f);
+    CHECK(texel_float(buf, mat + 2, 2) == 1.5f);
+
+    size_t sph = sphere_offset + SCENE_BUFFER_SPHERE_TEXELS;
+    CHECK(texel_float(buf, sph, 0) == 3.0f);
+    CHECK(texel_float(buf, sph, 3) == 2.0f);
+    CHECK(texel_int(buf, sph + 1, 0) == 1);
+
+    CHECK(texel_float(buf, triangle_offset, 0) == -1.0f);
+    CHECK(texel_int(buf, triangle_offset, 3) == 1);
+    CHECK(texel_float(buf, triangle_offset + 1, 1) == 1.0f);
+    CHECK(texel_float(buf, triangle_offset + 2, 2) == 1.0f);
+}
+
+void test_dirty_ranges(scene *world, scene_buffer *buf) {
+    CHECK(scene_buffer_dirty(buf));
+    CHECK(buf->resized);
+    CHECK(buf->dirty_begin == 0 && buf->dirty_end == buf->size);
+
+    // Packing an unchanged scene uploads nothing
+    scene_buffer_mark_clean(buf);
+    scene_buffer_pack(buf, world);
+    CHECK(!scene_buffer_dirty(buf));
+
+    // A moved sphere dirties exactly its own record
+    world->spheres[1].radius = 3;
+    scene_buffer_pack(buf, world);
+    size_t sph = SCENE_BUFFER_HEADER_TEXELS +
+                 2 * SCENE_BUFFER_MATERIAL_TEXELS +
+                 SCENE_BUFFER_SPHERE_TEXELS;
+    CHECK(!buf->resized);
+    CHECK(buf->dirty_begin == sph * SCENE_BUFFER_TEXEL_SIZE);
+    CHECK(buf->dirty_end ==
+          (sph + SCENE_BUFFER_SPHERE_TEXELS) * SCENE_BUFFER_TEXEL_SIZE);
+
+    // Changes far apart merge into one range covering both
+    scene_buffer_mark_clean(buf);
+    shape_material material = world->materials[0];
+    material.roughness = 0.75f;
+    CHECK(scene_set_material(world, 0, &material) == 0);
+    CHECK(world->hot_materials[0].roughness == 0.75f);
+    world->triangles[0].v2.z = 2;
+    scene_buffer_pack(buf, world);
+    CHECK(buf->dirty_begin == SCENE_BUFFER_HEADER_TEXELS *
+                                  SCENE_BUFFER_TEXEL_SIZE);
+    CHECK(buf->dirty_end == buf->size);
+
+    // New primitives change the layout and resize the buffer
+    scene_buffer_mark_clean(buf);
+    scene_add_sphere(world, glms_vec3_zero(), 1, 0);
+    scene_buffer_pack(buf, world);
+    CHECK(buf->resized);
+    CHECK(buf->dirty_begin == 0 && buf->dirty_end == buf->size);
+}
+
+// --- Public ---
+
+int main() {
+    scene world;
+    scene_init(&world);
+    scene_add_material(&world, glms_vec3_one(), 0.1f, 0, glms_vec3_zero(), 0,
+                       0, 1);
+    scene_add_material(&world, (vec3s){0.25f, 0.5f, 0.75f}, 0.5f, 1,
+                       glms_vec3_one(), 4, 0, 1.5f);
+    scene_add_sphere(&world, (vec3s){0, 0, -5}, 1, 0);
+    scene_add_sphere(&world, (vec3s){3, 0, -5}, 2, 1);
+    scene_add_triangle(&world, (vec3s){-1, 0, 0}, (vec3s){0, 1, 0},
+                       (vec3s){0, 0, 1}, 1);
+
+    scene_buffer buf;
+    scene_buffer_init(&buf);
+    scene_buffer_pack(&buf, &world);
+    test_layout(&buf);
+    test_dirty_ranges(&world, &buf);
+
+    scene_buffer_destroy(&buf);
+    scene_destroy(&world);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "ray.h"
+#include "scene_file.h"
+#include <cglm/struct.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+#define PACKED_PATH "scene_file_test.scene"
+#define CORRUPT_PATH "scene_file_test_corrupt.scene"
+
+int failures = 0;
+
+// --- Private ---
+
+uint8_t *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+
+    uint8_t *data = malloc(*size);
+    if (fread(data, 1, *size, fp) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+// Writes the packed file with size bytes at offset replaced and maps it
+int map_corrupted(const uint8_t *data, size_t size, size_t offset,
+                  const void *value, size_t value_size) {
+    uint8_t *copy = malloc(size);
+    memcpy(copy, data, size);
+    memcpy(copy + offset, value, value_size);
+
+    FILE *fp = fopen(CORRUPT_PATH, "wb");
+    fwrite(copy, 1, size, fp);
+    fclose(fp);
+    free(copy);
+
+    scene mapped;
+    int result = scene_file_map(&mapped, CORRUPT_PATH, 0);
+    if (result == 0)
+        scene_destroy(&mapped);
+    return result;
+}
+
+void build_scene(scene *world) {
+    scene_init(world);
+    scene_set_sky(world, (vec3s){0.1f, 0.2f, 0.3f});
+    scene_add_material(world, glms_vec3_one(), 1, 0, glms_vec3_zero(), 0, 0,
+                       1);
+    scene_add_material(world, (vec3s){0.5f, 0.25f, 1}, 0.2f, 1,
+                       glms_vec3_one(), 3, 0.5f, 1.5f);
+
+    for (int i = 0; i < 64; i++)
+        scene_add_sphere(world,
+                         (vec3s){(i % 8) * 2.5f - 9, (i / 8) * 2.5f - 9, 12},
+                         0.8f + 0.05f * (i % 5), i % 2);
+    for (int i = 0; i < 200; i++) {
+        float x = (i % 20) - 10.0f, y = (i / 20) * 2 - 10.0f;
+        scene_add_triangle(world, (vec3s){x, y, 8 + 0.1f * (i % 7)},
+                           (vec3s){x + 1.5f, y, 8},
+                           (vec3s){x, y + 1.5f, 9}, i % 2);
+    }
+    scene_build_accel(world);
+}
+
+void test_round_trip(const scene *source, const scene *mapped) {
+    CHECK(mapped->num_spheres == source->num_spheres);
+    CHECK(mapped->num_triangles == source->num_triangles);
+    CHECK(mapped->num_materials == source->num_materials);
+    CHECK(memcmp(mapped->materials, source->materials,
+                 source->num_materials * sizeof(shape_material)) == 0);
+    CHECK(glms_vec3_eqv(mapped->sky_color, source->sky_color));
+    CHECK(scene_geometry_hash(mapped) == scene_geometry_hash(source));
+    CHECK(scene_content_hash(mapped) == scene_content_hash(source));
+    CHECK(mapped->compact_accel.num_nodes > 0);
+
+    // The quantized tree must find hits as near as the binary one. Rays
+    // through shared edges may pick either triangle, so only distances are
+    // compared.
+    size_t mismatches = 0, hits = 0;
+    for (int y = -32; y < 32; y++) {
+        for (int x = -32; x < 32; x++) {
+            vec3s direction =
+                glms_vec3_normalize((vec3s){x / 32.0f, y / 32.0f, 1});
+            ray_hit a = trace_ray(glms_vec3_zero(), direction, source);
+            ray_hit b = trace_ray(glms_vec3_zero(), direction, mapped);
+            hits += a.distance >= 0;
+            if ((a.distance < 0) != (b.distance < 0) ||
+                fabsf(a.distance - b.distance) > 1e-4f)
+                mismatches++;
+        }
+    }
+    CHECK(hits > 0);
+    CHECK(mismatches == 0);
+}
+
+void test_reject_corrupt(const uint8_t *data, size_t size) {
+    const scene_file_header *header = (const scene_file_header *)data;
+
+    // Rewriting a field with its own value still maps
+    CHECK(map_corrupted(data, size, 0, SCENE_FILE_MAGIC, 8) == 0);
+
+    // Header fields
+    CHECK(map_corrupted(data, size, offsetof(scene_file_header, magic),
+                        "XXSCENE", 8) != 0);
+    uint32_t version = SCENE_FILE_VERSION + 1;
+    CHECK(map_corrupted(data, size, offsetof(scene_file_header, version),
+                        &version, sizeof(version)) != 0);
+    uint64_t file_size = size + SCENE_FILE_ALIGNMENT;
+    CHECK(map_corrupted(data, size, offsetof(scene_file_header, file_size),
+                        &file_size, sizeof(file_size)) != 0);
+    uint64_t offset = size;
+    CHECK(map_corrupted(data, size,
+                        offsetof(scene_file_header, triangles_offset),
+                        &offset, sizeof(offset)) != 0);
+
+    // Indices inside the sections
+    material_index material = header->num_materials;
+    CHECK(map_corrupted(data, size, header->sphere_materials_offset,
+                        &material, sizeof(material)) != 0);
+    CHECK(map_corrupted(data, size, header->triangle_materials_offset,
+                        &material, sizeof(material)) != 0);
+    uint32_t primitive = header->num_spheres + header->num_triangles;
+    CHECK(map_corrupted(data, size, header->indices_offset, &primitive,
+                        sizeof(primitive)) != 0);
+
+    // A root child pointing back at the root would loop forever
+    const wide_bvh_node *root =
+        (const wide_bvh_node *)(data + header->nodes_offset);
+    size_t interior = 0;
+    while (interior < root->num_children && root->count[interior] > 0)
+        interior++;
+    CHECK(interior < root->num_children);
+    uint32_t child = 0;
+    CHECK(map_corrupted(data, size,
+                        header->nodes_offset +
+                            offsetof(wide_bvh_node, child) +
+                            interior * sizeof(uint32_t),
+                        &child, sizeof(child)) != 0);
+    uint8_t num_children = WIDE_BVH_WIDTH + 1;
+    CHECK(map_corrupted(data, size,
+                        header->nodes_offset +
+                            offsetof(wide_bvh_node, num_children),
+                        &num_children, sizeof(num_children)) != 0);
+}
+
+// --- Public ---
+
+int main() {
+    scene world;
+    build_scene(&world);
+    scene_update_geometry_hash(&world);
+    CHECK(scene_file_write(&world, PACKED_PATH) == 0);
+
+    scene mapped;
+    CHECK(scene_file_map(&mapped, PACKED_PATH, 0) == 0);
+    test_round_trip(&world, &mapped);
+    scene_destroy(&mapped);
+
+    size_t size;
+    uint8_t *data = read_file(PACKED_PATH, &size);
+    CHECK(data != NULL);
+    if (data != NULL)
+        test_reject_corrupt(data, size);
+
+    free(data);
+    remove(PACKED_PATH);
+    remove(CORRUPT_PATH);
+    scene_destroy(&world);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}